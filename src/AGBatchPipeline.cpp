@@ -0,0 +1,310 @@
+//
+//  Created by Aleksander Grzyb on 21/09/15.
+//  Copyright (c) 2015 Aleksander Grzyb. All rights reserved.
+//
+
+#include "AGBatchPipeline.h"
+#include "AGOpenCVHelper.h"
+
+#include <thread>
+#include <algorithm>
+#include <iomanip>
+
+using namespace cv;
+using namespace std;
+
+#pragma mark -
+#pragma mark Initialization
+
+AGBatchPipeline::AGBatchPipeline(AGImageLoader &imageLoader,
+                                 const AGParameters &parameters,
+                                 const vector<AGStitchingVersion> &versions) :
+imageLoader(imageLoader),
+parameters(parameters),
+versions(versions),
+loadedMosaics(parameters.batchQueueCapacity),
+registeredMosaics(parameters.batchQueueCapacity),
+composedMosaics(parameters.batchQueueCapacity)
+{
+    this->loadingStatistics = { "Loading", 0, 0.0, 0.0 };
+    this->registrationStatistics = { "Registration", 0, 0.0, 0.0 };
+    this->compositionStatistics = { "Composition", 0, 0.0, 0.0 };
+    this->savingStatistics = { "Saving", 0, 0.0, 0.0 };
+    this->runTime = 0.0;
+    this->memoryBudget = (size_t)max(this->parameters.batchMemoryBudget, 1) * 1024 * 1024;
+    this->usedMemory = 0;
+    this->peakMemory = 0;
+    this->isStopping = false;
+    this->error = { false, "" };
+}
+
+#pragma mark -
+#pragma mark Running
+
+void AGBatchPipeline::run(AGError &error)
+{
+    int64 start = getTickCount();
+    // Every stage catches its own exceptions, so threads always finish and can be joined
+    thread loadingThread(&AGBatchPipeline::performLoading, this);
+    thread registrationThread(&AGBatchPipeline::performRegistration, this);
+    thread compositionThread(&AGBatchPipeline::performComposition, this);
+    thread savingThread(&AGBatchPipeline::performSaving, this);
+    loadingThread.join();
+    registrationThread.join();
+    compositionThread.join();
+    savingThread.join();
+    this->runTime = (getTickCount() - start) / getTickFrequency();
+
+    if (this->error.isError) {
+        error = this->error;
+    }
+}
+
+void AGBatchPipeline::stopWithError(const string &description)
+{
+    {
+        lock_guard<std::mutex> lock(this->mutex);
+        if (!this->error.isError) {
+            this->error = { true, description };
+        }
+        this->isStopping = true;
+    }
+    this->memoryReleased.notify_all();
+    this->loadedMosaics.close();
+    this->registeredMosaics.close();
+    this->composedMosaics.close();
+}
+
+#pragma mark -
+#pragma mark Stages
+
+void AGBatchPipeline::performLoading()
+{
+    try {
+        for (int i = 1; i <= this->parameters.numberOfMosaics; ++i) {
+            int64 start = getTickCount();
+            AGError loadError;
+            shared_ptr<AGRunReport> runReport = make_shared<AGRunReport>("mosaic_" + to_string(i));
+            vector<vector<AGImage>> *tiles = new vector<vector<AGImage>>();
+            this->imageLoader.loadTilesInMosaicNumber(*tiles, i, loadError, runReport.get());
+            if (loadError.isError) {
+                delete tiles;
+                this->stopWithError(loadError.description); return;
+            }
+            size_t size = AGBatchPipeline::memorySizeOfTiles(*tiles);
+            this->loadingStatistics.busyTime += (getTickCount() - start) / getTickFrequency();
+
+            start = getTickCount();
+            this->acquireMemory(size, true);
+            AGBatchJob job;
+            job.mosaicNumber = i;
+            job.tiles = shared_ptr<const vector<vector<AGImage>>>(tiles, [this, size](const vector<vector<AGImage>> *tiles) {
+                delete tiles;
+                this->releaseMemory(size);
+            });
+            job.featureCache = make_shared<AGFeatureCache>();
+            job.runReport = runReport;
+            job.version = 0;
+            bool isAdded = this->loadedMosaics.push(job);
+            this->loadingStatistics.waitTime += (getTickCount() - start) / getTickFrequency();
+            if (!isAdded) {
+                return;
+            }
+            this->loadingStatistics.numberOfJobs++;
+        }
+    }
+    catch (const exception &exception) {
+        this->stopWithError(string("performLoading: ") + exception.what());
+    }
+    this->loadedMosaics.close();
+}
+
+void AGBatchPipeline::performRegistration()
+{
+    try {
+        while (true) {
+            int64 start = getTickCount();
+            AGBatchJob mosaicJob;
+            if (!this->loadedMosaics.pop(mosaicJob)) {
+                break;
+            }
+            this->registrationStatistics.waitTime += (getTickCount() - start) / getTickFrequency();
+
+            for (int version = 0; version < (int)this->versions.size(); ++version) {
+                start = getTickCount();
+                AGParameters versionParameters = this->parameters;
+                versionParameters.simplerTransform = this->versions[version].simplerTransform;
+                versionParameters.rigidTransform = this->versions[version].rigidTransform;
+                versionParameters.usePaths = this->versions[version].usePaths;
+
+                AGBatchJob job = mosaicJob;
+                job.name = "mosaic_" + to_string(mosaicJob.mosaicNumber) + "_version_" + to_string(version + 1);
+                job.version = version;
+                job.stitcher = make_shared<AGMosaicStitcher>(versionParameters,
+                                                             job.featureCache.get(),
+                                                             job.runReport.get());
+                if (job.stitcher->registerMosaic(*job.tiles) == EXIT_FAILURE) {
+                    this->stopWithError("performRegistration: Couldn't register " + job.name + "."); return;
+                }
+                this->registrationStatistics.busyTime += (getTickCount() - start) / getTickFrequency();
+                this->registrationStatistics.numberOfJobs++;
+                // Report is saved as soon as the last version is saved, so counters are added before it is passed on
+                if (version == (int)this->versions.size() - 1) {
+                    job.runReport->increaseCounter("featureCache.hits", job.featureCache->numberOfHits());
+                    job.runReport->increaseCounter("featureCache.misses", job.featureCache->numberOfMisses());
+                }
+
+                start = getTickCount();
+                bool isAdded = this->registeredMosaics.push(job);
+                this->registrationStatistics.waitTime += (getTickCount() - start) / getTickFrequency();
+                if (!isAdded) {
+                    return;
+                }
+            }
+        }
+    }
+    catch (const exception &exception) {
+        this->stopWithError(string("performRegistration: ") + exception.what());
+    }
+    this->registeredMosaics.close();
+}
+
+void AGBatchPipeline::performComposition()
+{
+    try {
+        while (true) {
+            int64 start = getTickCount();
+            AGBatchJob job;
+            if (!this->registeredMosaics.pop(job)) {
+                break;
+            }
+            this->compositionStatistics.waitTime += (getTickCount() - start) / getTickFrequency();
+
+            start = getTickCount();
+            if (job.stitcher->composeMosaic(job.outputImage) == EXIT_FAILURE) {
+                this->stopWithError("performComposition: Couldn't compose " + job.name + "."); return;
+            }
+            // Tiles and registration result are not needed anymore, when this was the last version of the mosaic
+            // the memory of tiles goes back to the budget
+            job.stitcher.reset();
+            job.tiles.reset();
+            job.featureCache.reset();
+            // Composed mosaic is already in memory, so it is only accounted (waiting here could block the stage that
+            // releases memory)
+            this->acquireMemory(job.outputImage.total() * job.outputImage.elemSize(), false);
+            this->compositionStatistics.busyTime += (getTickCount() - start) / getTickFrequency();
+            this->compositionStatistics.numberOfJobs++;
+
+            start = getTickCount();
+            bool isAdded = this->composedMosaics.push(job);
+            this->compositionStatistics.waitTime += (getTickCount() - start) / getTickFrequency();
+            if (!isAdded) {
+                return;
+            }
+        }
+    }
+    catch (const exception &exception) {
+        this->stopWithError(string("performComposition: ") + exception.what());
+    }
+    this->composedMosaics.close();
+}
+
+void AGBatchPipeline::performSaving()
+{
+    try {
+        while (true) {
+            int64 start = getTickCount();
+            AGBatchJob job;
+            if (!this->composedMosaics.pop(job)) {
+                break;
+            }
+            this->savingStatistics.waitTime += (getTickCount() - start) / getTickFrequency();
+
+            start = getTickCount();
+            size_t size = job.outputImage.total() * job.outputImage.elemSize();
+            AGError saveError;
+            {
+                AGStageTimer timer(job.runReport.get(), "encode");
+                AGOpenCVHelper::saveImage(job.outputImage,
+                                          job.name,
+                                          this->parameters.mosaicsSaveAbsolutePath,
+                                          saveError,
+                                          this->parameters.outputFormat);
+            }
+            if (saveError.isError) {
+                cout << "performSaving: " << saveError.description << endl;
+            }
+            // Jobs come in order, so report of the mosaic is complete after its last version
+            if (job.version == (int)this->versions.size() - 1) {
+                AGError reportError;
+                job.runReport->saveToFile(this->parameters.mosaicsSaveAbsolutePath, reportError);
+                if (reportError.isError) {
+                    cout << "performSaving: " << reportError.description << endl;
+                }
+            }
+            job.outputImage.release();
+            this->releaseMemory(size);
+            this->savingStatistics.busyTime += (getTickCount() - start) / getTickFrequency();
+            this->savingStatistics.numberOfJobs++;
+        }
+    }
+    catch (const exception &exception) {
+        this->stopWithError(string("performSaving: ") + exception.what());
+    }
+}
+
+#pragma mark -
+#pragma mark Memory Budget
+
+void AGBatchPipeline::acquireMemory(size_t size, bool shouldWait)
+{
+    unique_lock<std::mutex> lock(this->mutex);
+    if (shouldWait) {
+        // Mosaic larger than the whole budget is still processed, but only when nothing else is in the pipeline
+        this->memoryReleased.wait(lock, [this, size] {
+            return this->isStopping || this->usedMemory == 0 || this->usedMemory + size <= this->memoryBudget;
+        });
+    }
+    this->usedMemory += size;
+    this->peakMemory = max(this->peakMemory, this->usedMemory);
+}
+
+void AGBatchPipeline::releaseMemory(size_t size)
+{
+    {
+        lock_guard<std::mutex> lock(this->mutex);
+        this->usedMemory -= min(size, this->usedMemory);
+    }
+    this->memoryReleased.notify_all();
+}
+
+size_t AGBatchPipeline::memorySizeOfTiles(const vector<vector<AGImage>> &tiles)
+{
+    size_t size = 0;
+    for (auto &column : tiles) {
+        for (auto &tile : column) {
+            size += tile.image.total() * tile.image.elemSize();
+        }
+    }
+    return size;
+}
+
+#pragma mark -
+#pragma mark Report
+
+void AGBatchPipeline::printThroughputReport()
+{
+    vector<AGStageStatistics> stages = { this->loadingStatistics,
+                                         this->registrationStatistics,
+                                         this->compositionStatistics,
+                                         this->savingStatistics };
+    cout << "Batch pipeline finished in " << this->runTime << " s "
+         << "(peak memory " << this->peakMemory / (1024 * 1024) << " MB)" << endl;
+    for (auto &stage : stages) {
+        double throughput = stage.busyTime > 0.0 ? stage.numberOfJobs / stage.busyTime : 0.0;
+        cout << left << setw(14) << stage.name << right
+             << stage.numberOfJobs << " jobs, busy " << stage.busyTime << " s, waiting " << stage.waitTime << " s, "
+             << throughput << " jobs/s" << endl;
+    }
+    cout << endl;
+}
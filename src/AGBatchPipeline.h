@@ -0,0 +1,254 @@
+//
+//  Created by Aleksander Grzyb on 21/09/15.
+//  Copyright (c) 2015 Aleksander Grzyb. All rights reserved.
+//
+
+#ifndef __Mosaic_Stitcher__AGBatchPipeline__
+#define __Mosaic_Stitcher__AGBatchPipeline__
+
+#include "AGDataStructures.h"
+#include "AGBoundedQueue.h"
+#include "AGFeatureCache.h"
+#include "AGImageLoader.h"
+#include "AGMosaicStitcher.h"
+#include "AGRunReport.h"
+
+#include <stdio.h>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <opencv2/opencv.hpp>
+
+ /// Unit of work passed between stages of AGBatchPipeline.
+
+struct AGBatchJob {
+    
+    /**
+     *  Identifier of the mosaic.
+     */
+    int mosaicNumber;
+    
+    /**
+     *  Name of output image.
+     */
+    std::string name;
+    
+    /**
+     *  Loaded tiles (shared by all versions of the mosaic). Memory of tiles is returned to the pipeline budget when
+     *  the last job of the mosaic releases them.
+     */
+    std::shared_ptr<const std::vector<std::vector<AGImage>>> tiles;
+    
+    /**
+     *  Features shared by all versions of the mosaic.
+     */
+    std::shared_ptr<AGFeatureCache> featureCache;
+    
+    /**
+     *  Report of the mosaic (shared by all versions, saved after the last version).
+     */
+    std::shared_ptr<AGRunReport> runReport;
+    
+    /**
+     *  Index of stitching version (in versions vector).
+     */
+    int version;
+    
+    /**
+     *  Stitcher holding registration result between registration and composition stages.
+     */
+    std::shared_ptr<AGMosaicStitcher> stitcher;
+    
+    /**
+     *  Composed mosaic.
+     */
+    cv::Mat outputImage;
+};
+
+ /// Work statistics of one stage of AGBatchPipeline.
+
+struct AGStageStatistics {
+    
+    /**
+     *  Name of the stage.
+     */
+    std::string name;
+    
+    /**
+     *  Number of processed jobs.
+     */
+    int numberOfJobs;
+    
+    /**
+     *  Time spent on processing jobs (seconds).
+     */
+    double busyTime;
+    
+    /**
+     *  Time spent on waiting for input or for space in output queue (seconds).
+     */
+    double waitTime;
+};
+
+ /// Stitches all mosaics from configuration file in pipeline of four stages (loading, registration, composition and
+ /// saving), each running in its own thread and connected by bounded queues. While one mosaic is registered, the next
+ /// one is decoded and the previous one is blended or encoded. Loading of the next mosaic is held back while memory
+ /// used by mosaics in the pipeline exceeds the budget.
+
+class AGBatchPipeline {
+public:
+    
+    /**
+     *  Constructor of AGBatchPipeline object.
+     *
+     *  @param imageLoader Loader of tiles.
+     *  @param parameters  Loaded parameters from configuration file.
+     *  @param versions    Stitching versions produced for every mosaic.
+     */
+    AGBatchPipeline(AGImageLoader &imageLoader,
+                    const AGParameters &parameters,
+                    const std::vector<AGStitchingVersion> &versions);
+    
+    /**
+     *  Stitches all mosaics. Blocks until all of them are saved or first error occurs.
+     *
+     *  @param error Error.
+     */
+    void run(AGError &error);
+    
+    /**
+     *  Prints number of processed jobs, busy and waiting time and throughput of every stage.
+     */
+    void printThroughputReport();
+    
+private:
+    
+    /**
+     *  Loading stage. Decodes tiles of consecutive mosaics.
+     */
+    void performLoading();
+    
+    /**
+     *  Registration stage. Registers tiles of every mosaic in every version.
+     */
+    void performRegistration();
+    
+    /**
+     *  Composition stage. Warps and blends registered mosaics.
+     */
+    void performComposition();
+    
+    /**
+     *  Saving stage. Encodes and writes mosaics to disc.
+     */
+    void performSaving();
+    
+    /**
+     *  Reserves memory in the budget.
+     *
+     *  @param size       Size in bytes.
+     *  @param shouldWait Blocks until there is enough free memory in the budget (or nothing else is reserved).
+     */
+    void acquireMemory(size_t size, bool shouldWait);
+    
+    /**
+     *  Returns memory to the budget.
+     *
+     *  @param size Size in bytes.
+     */
+    void releaseMemory(size_t size);
+    
+    /**
+     *  Stores the first error and stops all stages.
+     *
+     *  @param description Description of the error.
+     */
+    void stopWithError(const std::string &description);
+    
+    /**
+     *  Calculates size of pixel data of tiles.
+     *
+     *  @param tiles Matrix of tiles.
+     *
+     *  @return Size in bytes.
+     */
+    static size_t memorySizeOfTiles(const std::vector<std::vector<AGImage>> &tiles);
+    
+    /**
+     *  Loader of tiles.
+     */
+    AGImageLoader &imageLoader;
+    
+    /**
+     *  Loaded parameters from configuration file.
+     */
+    AGParameters parameters;
+    
+    /**
+     *  Stitching versions produced for every mosaic.
+     */
+    std::vector<AGStitchingVersion> versions;
+    
+    /**
+     *  Queue between loading and registration stages.
+     */
+    AGBoundedQueue<AGBatchJob> loadedMosaics;
+    
+    /**
+     *  Queue between registration and composition stages.
+     */
+    AGBoundedQueue<AGBatchJob> registeredMosaics;
+    
+    /**
+     *  Queue between composition and saving stages.
+     */
+    AGBoundedQueue<AGBatchJob> composedMosaics;
+    
+    /**
+     *  Statistics of stages (in order of the pipeline).
+     */
+    AGStageStatistics loadingStatistics, registrationStatistics, compositionStatistics, savingStatistics;
+    
+    /**
+     *  Wall time of the whole run (seconds).
+     */
+    double runTime;
+    
+    /**
+     *  Memory budget in bytes.
+     */
+    size_t memoryBudget;
+    
+    /**
+     *  Memory reserved by mosaics in the pipeline (bytes).
+     */
+    size_t usedMemory;
+    
+    /**
+     *  Highest value of usedMemory during the run (bytes).
+     */
+    size_t peakMemory;
+    
+    /**
+     *  Guards memory counters, error and stopping flag.
+     */
+    std::mutex mutex;
+    
+    /**
+     *  Signalled when memory is released or pipeline is stopping.
+     */
+    std::condition_variable memoryReleased;
+    
+    /**
+     *  Informs stages that they should finish.
+     */
+    bool isStopping;
+    
+    /**
+     *  First error reported by any stage.
+     */
+    AGError error;
+};
+
+#endif /* defined(__Mosaic_Stitcher__AGBatchPipeline__) */
@@ -0,0 +1,111 @@
+//
+//  Created by Aleksander Grzyb on 21/09/15.
+//  Copyright (c) 2015 Aleksander Grzyb. All rights reserved.
+//
+
+#ifndef __Mosaic_Stitcher__AGBoundedQueue__
+#define __Mosaic_Stitcher__AGBoundedQueue__
+
+#include <stdio.h>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+ /// Thread safe FIFO queue with limited capacity. Connects stages of AGBatchPipeline, producer is blocked while the
+ /// queue is full, so fast stage can't run far ahead of slow one.
+
+template <typename T>
+class AGBoundedQueue {
+public:
+    
+    /**
+     *  Constructor of AGBoundedQueue object.
+     *
+     *  @param capacity Maximal number of items in the queue (at least 1).
+     */
+    AGBoundedQueue(size_t capacity) : capacity(capacity > 0 ? capacity : 1), isClosed(false) {}
+    
+    /**
+     *  Adds item to the queue. Blocks while the queue is full.
+     *
+     *  @param item Item to add.
+     *
+     *  @return False when the queue was closed (item is not added).
+     */
+    bool push(const T &item)
+    {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->notFull.wait(lock, [this] { return this->isClosed || this->items.size() < this->capacity; });
+        if (this->isClosed) {
+            return false;
+        }
+        this->items.push_back(item);
+        this->notEmpty.notify_one();
+        return true;
+    }
+    
+    /**
+     *  Takes item from the queue. Blocks while the queue is empty.
+     *
+     *  @param item Output item.
+     *
+     *  @return False when the queue was closed and there are no more items.
+     */
+    bool pop(T &item)
+    {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->notEmpty.wait(lock, [this] { return this->isClosed || !this->items.empty(); });
+        if (this->items.empty()) {
+            return false;
+        }
+        item = this->items.front();
+        this->items.pop_front();
+        this->notFull.notify_one();
+        return true;
+    }
+    
+    /**
+     *  Closes the queue. Items already added can still be taken, new items are rejected.
+     */
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->isClosed = true;
+        this->notEmpty.notify_all();
+        this->notFull.notify_all();
+    }
+    
+private:
+    
+    /**
+     *  Items in the queue.
+     */
+    std::deque<T> items;
+    
+    /**
+     *  Maximal number of items in the queue.
+     */
+    size_t capacity;
+    
+    /**
+     *  Informs that no more items will be added.
+     */
+    bool isClosed;
+    
+    /**
+     *  Guards items.
+     */
+    std::mutex mutex;
+    
+    /**
+     *  Signalled when item is added or queue is closed.
+     */
+    std::condition_variable notEmpty;
+    
+    /**
+     *  Signalled when item is taken or queue is closed.
+     */
+    std::condition_variable notFull;
+};
+
+#endif /* defined(__Mosaic_Stitcher__AGBoundedQueue__) */
@@ -27,6 +27,79 @@ const int FIRST_ROW = 0;
  */
 const double PATH_RANGE = 20.0;
 
+/**
+ *  Parameters of AGRobustEstimator class: maximal distance (in pixels) between transformed point and its
+ *  correspondence for inliers, required probability of drawing at least one sample without outliers and maximal
+ *  number of samples.
+ */
+const double ROBUST_ESTIMATOR_THRESHOLD = 3.0;
+const double ROBUST_ESTIMATOR_CONFIDENCE = 0.995;
+const int ROBUST_ESTIMATOR_MAXIMAL_ITERATIONS = 2000;
+
+/**
+ *  Parameters of SIFT detector used by AGMosaicStitcher class.
+ */
+const int SIFT_NUMBER_OF_FEATURES = 0;
+const int SIFT_NUMBER_OF_OCTAVE_LAYERS = 3;
+const double SIFT_CONTRAST_THRESHOLD = 0.02;
+const double SIFT_EDGE_THRESHOLD = 10;
+const double SIFT_SIGMA = 1.5;
+
+/**
+ *  Parameters of ORB detector (AGORBFeatureExtractor class).
+ */
+const int ORB_NUMBER_OF_FEATURES = 1000;
+const float ORB_SCALE_FACTOR = 1.2f;
+const int ORB_NUMBER_OF_LEVELS = 8;
+const int ORB_EDGE_THRESHOLD = 31;
+const int ORB_PATCH_SIZE = 31;
+
+/**
+ *  Parameters of BRISK detector (AGBRISKFeatureExtractor class).
+ */
+const int BRISK_THRESHOLD = 30;
+const int BRISK_NUMBER_OF_OCTAVES = 3;
+const float BRISK_PATTERN_SCALE = 1.0f;
+
+/**
+ *  Margin (in pixels) added around overlap region before running features detector on it. Keypoints near the border
+ *  of region still get their whole neighbourhood (detector border and descriptor window).
+ */
+const int FEATURES_STRIP_MARGIN = 32;
+
+/**
+ *  Minimal width and height (in pixels) of template compared by AGPyramidEngine class at full resolution. Strips are
+ *  not downsampled below twice this size.
+ */
+const int PYRAMID_ENGINE_MINIMAL_TEMPLATE_SIZE = 8;
+
+/**
+ *  Parameters of AGECCRefinement class: number of pyramid levels below full resolution, maximal number of iterations
+ *  on one level, minimal change of correlation coefficient between iterations, maximal correction of initial
+ *  transform (in pixels) and minimal width and height of compared regions.
+ */
+const int ECC_PYRAMID_LEVELS = 2;
+const int ECC_MAXIMAL_ITERATIONS = 15;
+const double ECC_EPSILON = 1e-4;
+const int ECC_MAXIMAL_CORRECTION = 16;
+const int ECC_MINIMAL_REGION_SIZE = 16;
+
+/**
+ *  Parameters of AGSkeletonEngine class: minimal and maximal number of skeleton points of overlap region, number of
+ *  points used by chamfer search and its step (in pixels), distance above which distance to skeleton is truncated,
+ *  maximal distance of ICP correspondences, maximal number of ICP iterations and change of transform at which they
+ *  stop, and distance to skeleton of points counted in confidence.
+ */
+const int SKELETON_ENGINE_MINIMAL_POINTS = 20;
+const int SKELETON_ENGINE_MAXIMAL_POINTS = 1000;
+const int SKELETON_ENGINE_CHAMFER_POINTS = 200;
+const int SKELETON_ENGINE_SEARCH_STEP = 2;
+const float SKELETON_ENGINE_TRUNCATION_DISTANCE = 10.0f;
+const float SKELETON_ENGINE_CORRESPONDENCE_DISTANCE = 5.0f;
+const int SKELETON_ENGINE_ICP_ITERATIONS = 20;
+const double SKELETON_ENGINE_ICP_EPSILON = 1e-3;
+const float SKELETON_ENGINE_INLIER_DISTANCE = 2.0f;
+
 /**
  *  Informs about relationship between two images. For example direction 'Up' tells that first image is below second
  *  image and the first image would be transformed.
@@ -53,6 +126,47 @@ struct AGError {
     std::string description;
 };
 
+ /// Backend used for matching descriptors.
+
+enum AGMatchingBackend {
+    
+    /**
+     *  FLANN when number of keypoints exceeds flannKeypointsThreshold parameter, brute force otherwise.
+     */
+    AutomaticMatching = 0,
+    
+    /**
+     *  Exact brute force matching.
+     */
+    BruteForceMatching = 1,
+    
+    /**
+     *  Approximate matching with FLANN kd-trees.
+     */
+    FLANNMatching = 2
+};
+
+ /// Models of transform between two images estimated by AGRobustEstimator.
+
+enum AGTransformModel {
+    
+    /**
+     *  Shift only (one correspondence per sample).
+     */
+    TranslationModel = 0,
+    
+    /**
+     *  Rotation and shift (two correspondences per sample).
+     */
+    RigidModel = 1,
+    
+    /**
+     *  Rotation, uniform scale and shift, the same model as estimateRigidTransform(..., false) (two correspondences
+     *  per sample).
+     */
+    SimilarityModel = 2
+};
+
  /// Captures all program parameters.
 
 struct AGParameters {
@@ -75,6 +189,82 @@ struct AGParameters {
      */
     double shiftParameter;
     
+    /**
+     *  Maximal ratio of distances to the nearest and the second nearest neighbour of matched descriptor (1.0
+     *  disables ratio test). Optional in configuration file.
+     */
+    double ratioTestParameter;
+    
+    /**
+     *  Compares descriptors only when their keypoints agree (within shiftParameter) with placement of images predicted
+     *  from the grid and percentOverlap. Optional in configuration file.
+     */
+    bool guidedMatching;
+    
+    /**
+     *  Name of features extractor ("sift", "orb" or "brisk"). Optional in configuration file.
+     */
+    std::string featureExtractor;
+    
+    /**
+     *  Maximal number of keypoints kept in one overlap region (selected evenly over the region, 0 means no limit).
+     *  Optional in configuration file.
+     */
+    int keypointBudget;
+    
+    /**
+     *  Stores descriptors with one byte per dimension and matches them with integer kernels. Optional in
+     *  configuration file.
+     */
+    bool quantizedDescriptors;
+    
+    /**
+     *  Backend used for matching descriptors. Optional in configuration file.
+     */
+    AGMatchingBackend matchingBackend;
+    
+    /**
+     *  Number of keypoints (in one of images) above which automatic matching backend uses FLANN. Optional in
+     *  configuration file.
+     */
+    int flannKeypointsThreshold;
+    
+    /**
+     *  Name of engine that registers pairs of tiles directly from overlap regions before features are used
+     *  ("features" disables it, "phaseCorrelation", "pyramid" or "skeleton"). Optional in configuration file.
+     */
+    std::string registrationEngine;
+    
+    /**
+     *  Number of times overlap regions are downsampled by pyramid registration engine before coarse estimation (2
+     *  means 1/4 of resolution, 3 means 1/8). Optional in configuration file.
+     */
+    int pyramidLevels;
+    
+    /**
+     *  Refines every transform between images by maximizing correlation of their overlap regions. Optional in
+     *  configuration file.
+     */
+    bool eccRefinement;
+    
+    /**
+     *  Minimal confidence (from 0 to 1) of transform found by registration engine. Pairs registered with lower
+     *  confidence are registered with features. Optional in configuration file.
+     */
+    double registrationConfidence;
+    
+    /**
+     *  Names of registration engines tried in order (cheapest first) before features. Replaces registrationEngine
+     *  when it is not empty. Optional in configuration file.
+     */
+    std::vector<std::string> registrationTiers;
+    
+    /**
+     *  Minimal correlation coefficient of overlap regions placed by transform of registration engine. Pairs with lower
+     *  consistency are escalated to the next tier (0 disables the check). Optional in configuration file.
+     */
+    double consistencyThreshold;
+    
     /**
      *  Parameter used to control number of mosaic to load from disc. Required to set in configuration file.
      */
@@ -90,6 +280,50 @@ struct AGParameters {
      */
     std::string mosaicsDirectoryAbsolutePath;
     
+    /**
+     *  Number of threads used for registration of tile pairs (0 means number of CPU cores). Optional in
+     *  configuration file.
+     */
+    int numberOfThreads;
+    
+    /**
+     *  Number of threads used for decoding tile images (0 means number of CPU cores). Optional in configuration file.
+     */
+    int numberOfIOThreads;
+    
+    /**
+     *  Indicates if mosaics should be stitched in pipelined batch mode (see AGBatchPipeline). Optional in
+     *  configuration file.
+     */
+    bool batchMode;
+    
+    /**
+     *  Capacity of queues between stages of batch mode. Optional in configuration file.
+     */
+    int batchQueueCapacity;
+    
+    /**
+     *  Memory budget (in MB) for mosaics processed at the same time in batch mode. Optional in configuration file.
+     */
+    int batchMemoryBudget;
+    
+    /**
+     *  Indicates if tiles are warped as single channel images (without conversion to BGRA). Optional in configuration
+     *  file.
+     */
+    bool grayscalePipeline;
+    
+    /**
+     *  Format (file extension) of saved mosaics, "png" or "tiff". Optional in configuration file.
+     */
+    std::string outputFormat;
+    
+    /**
+     *  Indicates if optimised routines are compared with their reference implementations on stitched mosaics
+     *  (execution times and differences are printed). Optional in configuration file.
+     */
+    bool benchmarkMode;
+    
     /**
      *  Indicates if program should use simpler transform. Explained in chapter 4.4.5 in master's thesis. Set
      *  by program itself (not in configuration file).
@@ -102,6 +336,12 @@ struct AGParameters {
      */
     bool rigidTransform;
     
+    /**
+     *  Model of transform estimated when rigidTransform is set (SimilarityModel or RigidModel). Optional in
+     *  configuration file.
+     */
+    AGTransformModel rigidTransformModel;
+    
     /**
      *  Indicates if program should use blood vessels detection. Explained in chapter 4.4.5 in master's thesis. Set
      *  by program itself (not in configuration file).
@@ -124,6 +364,46 @@ struct AGParameters {
     bool clustering;
 };
 
+ /// Parameters that differ between stitching versions of the same mosaic. Explained in chapter 4.4.5 in master's thesis.
+
+struct AGStitchingVersion {
+    
+    /**
+     *  Indicates if program should use simpler transform.
+     */
+    bool simplerTransform;
+    
+    /**
+     *  Indicates if program should use rigid transform.
+     */
+    bool rigidTransform;
+    
+    /**
+     *  Indicates if program should use blood vessels detection.
+     */
+    bool usePaths;
+};
+
+ /// Describes registration of two neighbouring tiles in the mosaic grid.
+
+struct AGImagePair {
+    
+    /**
+     *  Coordinates of the first (transformed) image in images matrix.
+     */
+    cv::Point imageOneCoordinates;
+    
+    /**
+     *  Coordinates of the second (reference) image in images matrix.
+     */
+    cv::Point imageTwoCoordinates;
+    
+    /**
+     *  Stitching direction (see ImageDirection enum).
+     */
+    ImageDirection imageDirection;
+};
+
  /// Main structure of program. Captures all properties of image.
 
 struct AGImage {
@@ -167,6 +447,18 @@ struct AGImage {
      */
     cv::Mat distanceTransform;
     
+    /**
+     *  Transformation (3x3) that places image on the final mosaic plane in one step. Composed from the base shift
+     *  and the chain of transformations between neighbouring tiles that leads to the reference tile.
+     */
+    cv::Mat globalTransform;
+    
+    /**
+     *  Bounding box of the transformed image on the final mosaic plane. After warping, image and mask contain only
+     *  this region and its corner is their position on the plane.
+     */
+    cv::Rect boundingBox;
+    
     /**
      *  Width of image (done, because during creation of final grid the image is copied and
      *  loses information about its original width and height, which is needed for matches filtering).
@@ -203,6 +495,11 @@ struct AGImage {
      *  Points that point to the place where detected blood vessels are in the edges of image.
      */
     std::vector<cv::Point> pathPoints;
+    
+    /**
+     *  Skeleton of detected blood vessels (white pixels, kept after path detection for skeleton registration engine).
+     */
+    cv::Mat skeleton;
 };
 
 #endif
@@ -0,0 +1,570 @@
+//
+//  Created by Aleksander Grzyb on 21/09/15.
+//  Copyright (c) 2015 Aleksander Grzyb. All rights reserved.
+//
+
+#include "AGDescriptorMatcher.h"
+
+#include <cfloat>
+#include <cmath>
+#include <algorithm>
+#include <map>
+#include <cstring>
+#include <cstdint>
+#include <opencv2/flann/flann.hpp>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace cv;
+using namespace std;
+
+/**
+ *  Number of descriptors of first and second set in one block. Block of 128 dimensional SIFT descriptors takes
+ *  16 kB and 64 kB, so both stay in cache while all distances of the block are computed.
+ */
+static const int QUERY_BLOCK_SIZE = 32;
+static const int TRAIN_BLOCK_SIZE = 128;
+
+/**
+ *  Parameters of FLANN matching: number of randomized kd-trees and number of leaves checked during search.
+ */
+static const int FLANN_NUMBER_OF_TREES = 4;
+static const int FLANN_NUMBER_OF_CHECKS = 64;
+
+/**
+ *  Parameters of FLANN matching of binary descriptors: number of hash tables, number of bits of hash key and
+ *  multi-probe level of locality sensitive hashing.
+ */
+static const int FLANN_NUMBER_OF_HASH_TABLES = 12;
+static const int FLANN_HASH_KEY_SIZE = 20;
+static const int FLANN_MULTI_PROBE_LEVEL = 2;
+
+/**
+ *  Maximal number of cells (in one dimension) of grid used by guided matching. Cells are enlarged when search window
+ *  is very small compared to the region covered by keypoints.
+ */
+static const int GUIDED_MATCHING_MAXIMAL_GRID_SIZE = 256;
+
+#pragma mark -
+#pragma mark Matching
+
+void AGDescriptorMatcher::matchDescriptors(const Mat &descriptorsOne,
+                                           const Mat &descriptorsTwo,
+                                           const AGParameters &parameters,
+                                           vector<DMatch> &matches,
+                                           int normType)
+{
+    bool useFLANN = parameters.matchingBackend == FLANNMatching;
+    if (parameters.matchingBackend == AutomaticMatching) {
+        useFLANN = max(descriptorsOne.rows, descriptorsTwo.rows) > parameters.flannKeypointsThreshold;
+    }
+    if (useFLANN) {
+        AGDescriptorMatcher::matchMutualNearestNeighboursWithFLANN(descriptorsOne,
+                                                                  descriptorsTwo,
+                                                                  parameters.ratioTestParameter,
+                                                                  matches,
+                                                                  normType);
+    }
+    else {
+        AGDescriptorMatcher::matchMutualNearestNeighbours(descriptorsOne,
+                                                          descriptorsTwo,
+                                                          parameters.ratioTestParameter,
+                                                          matches,
+                                                          normType);
+    }
+}
+
+void AGDescriptorMatcher::matchMutualNearestNeighbours(const Mat &descriptorsOne,
+                                                       const Mat &descriptorsTwo,
+                                                       float ratio,
+                                                       vector<DMatch> &matches,
+                                                       int normType)
+{
+    matches.clear();
+    if (descriptorsOne.empty() || descriptorsTwo.empty() || descriptorsOne.cols != descriptorsTwo.cols) {
+        return;
+    }
+    if (normType == NORM_HAMMING) {
+        if (descriptorsOne.type() != CV_8U || descriptorsTwo.type() != CV_8U) {
+            return;
+        }
+        AGDescriptorMatcher::findMutualNearestNeighbours<uchar, &AGDescriptorMatcher::hammingDistance>(descriptorsOne,
+                                                                                                     descriptorsTwo,
+                                                                                                     ratio,
+                                                                                                     matches);
+        return;
+    }
+    // Quantized descriptors are matched with integer kernels, descriptors of other types are converted to float
+    if (descriptorsOne.type() == CV_8U && descriptorsTwo.type() == CV_8U) {
+        AGDescriptorMatcher::findMutualNearestNeighbours<uchar, &AGDescriptorMatcher::squaredDistance>(descriptorsOne,
+                                                                                                     descriptorsTwo,
+                                                                                                     ratio * ratio,
+                                                                                                     matches);
+    }
+    else {
+        Mat one = descriptorsOne, two = descriptorsTwo;
+        if (one.type() != CV_32F) {
+            descriptorsOne.convertTo(one, CV_32F);
+        }
+        if (two.type() != CV_32F) {
+            descriptorsTwo.convertTo(two, CV_32F);
+        }
+        AGDescriptorMatcher::findMutualNearestNeighbours<float, &AGDescriptorMatcher::squaredDistance>(one,
+                                                                                                     two,
+                                                                                                     ratio * ratio,
+                                                                                                     matches);
+    }
+    AGDescriptorMatcher::takeSquareRootOfDistances(matches);
+}
+
+template <typename T, float (*Distance)(const T *, const T *, int)>
+void AGDescriptorMatcher::findMutualNearestNeighbours(const Mat &one,
+                                                      const Mat &two,
+                                                      float distanceRatio,
+                                                      vector<DMatch> &matches)
+{
+    int length = one.cols;
+    vector<float> rowBest(one.rows, FLT_MAX), rowSecondBest(one.rows, FLT_MAX), columnBest(two.rows, FLT_MAX);
+    vector<int> rowBestIndex(one.rows, -1), columnBestIndex(two.rows, -1);
+
+    for (int rowBlock = 0; rowBlock < one.rows; rowBlock += QUERY_BLOCK_SIZE) {
+        int rowBlockEnd = min(rowBlock + QUERY_BLOCK_SIZE, one.rows);
+        for (int columnBlock = 0; columnBlock < two.rows; columnBlock += TRAIN_BLOCK_SIZE) {
+            int columnBlockEnd = min(columnBlock + TRAIN_BLOCK_SIZE, two.rows);
+            for (int row = rowBlock; row < rowBlockEnd; ++row) {
+                const T *descriptorOne = one.ptr<T>(row);
+                for (int column = columnBlock; column < columnBlockEnd; ++column) {
+                    float distance = Distance(descriptorOne, two.ptr<T>(column), length);
+                    // Strict comparisons keep the first of equal neighbours, the same as BFMatcher
+                    if (distance < rowBest[row]) {
+                        rowSecondBest[row] = rowBest[row];
+                        rowBest[row] = distance;
+                        rowBestIndex[row] = column;
+                    }
+                    else if (distance < rowSecondBest[row]) {
+                        rowSecondBest[row] = distance;
+                    }
+                    if (distance < columnBest[column]) {
+                        columnBest[column] = distance;
+                        columnBestIndex[column] = row;
+                    }
+                }
+            }
+        }
+    }
+
+    for (int row = 0; row < one.rows; ++row) {
+        int column = rowBestIndex[row];
+        if (column < 0 || columnBestIndex[column] != row) {
+            continue;
+        }
+        if (distanceRatio < 1.0f && rowSecondBest[row] != FLT_MAX
+            && rowBest[row] >= distanceRatio * rowSecondBest[row]) {
+            continue;
+        }
+        matches.push_back(DMatch(row, column, rowBest[row]));
+    }
+}
+
+void AGDescriptorMatcher::matchMutualNearestNeighboursWithFLANN(const Mat &descriptorsOne,
+                                                                const Mat &descriptorsTwo,
+                                                                float ratio,
+                                                                vector<DMatch> &matches,
+                                                                int normType)
+{
+    matches.clear();
+    if (descriptorsOne.empty() || descriptorsTwo.empty() || descriptorsOne.cols != descriptorsTwo.cols) {
+        return;
+    }
+    // Ratio test needs second neighbour (and FLANN needs at least as many points as searched neighbours)
+    if (descriptorsOne.rows < 2 || descriptorsTwo.rows < 2) {
+        AGDescriptorMatcher::matchMutualNearestNeighbours(descriptorsOne, descriptorsTwo, ratio, matches, normType);
+        return;
+    }
+    bool isHamming = normType == NORM_HAMMING;
+    Mat one = descriptorsOne, two = descriptorsTwo;
+    if (isHamming && (one.type() != CV_8U || two.type() != CV_8U)) {
+        return;
+    }
+    if (!isHamming) {
+        descriptorsOne.convertTo(one, CV_32F);
+        descriptorsTwo.convertTo(two, CV_32F);
+    }
+
+    // Binary descriptors are indexed with locality sensitive hashing, float descriptors with randomized kd-trees
+    Ptr<flann::IndexParams> indexParams;
+    cvflann::flann_distance_t distanceType = cvflann::FLANN_DIST_L2;
+    if (isHamming) {
+        indexParams = new flann::LshIndexParams(FLANN_NUMBER_OF_HASH_TABLES, FLANN_HASH_KEY_SIZE, FLANN_MULTI_PROBE_LEVEL);
+        distanceType = cvflann::FLANN_DIST_HAMMING;
+    }
+    else {
+        indexParams = new flann::KDTreeIndexParams(FLANN_NUMBER_OF_TREES);
+    }
+    flann::Index indexOne(one, *indexParams, distanceType);
+    flann::Index indexTwo(two, *indexParams, distanceType);
+
+    // Distances returned by FLANN are squared L2 distances (float) or Hamming distances (int)
+    Mat rowIndices, rowDistances, columnIndices, columnDistances;
+    indexTwo.knnSearch(one, rowIndices, rowDistances, 2, flann::SearchParams(FLANN_NUMBER_OF_CHECKS));
+    indexOne.knnSearch(two, columnIndices, columnDistances, 1, flann::SearchParams(FLANN_NUMBER_OF_CHECKS));
+    rowDistances.convertTo(rowDistances, CV_32F);
+
+    float distanceRatio = isHamming ? ratio : ratio * ratio;
+    for (int row = 0; row < one.rows; ++row) {
+        int column = rowIndices.at<int>(row, 0);
+        if (column < 0 || column >= two.rows || columnIndices.at<int>(column, 0) != row) {
+            continue;
+        }
+        float bestDistance = rowDistances.at<float>(row, 0);
+        float secondBestDistance = rowDistances.at<float>(row, 1);
+        // LSH can return less than two neighbours (index -1), ratio test is skipped then
+        if (distanceRatio < 1.0f && rowIndices.at<int>(row, 1) >= 0 && bestDistance >= distanceRatio * secondBestDistance) {
+            continue;
+        }
+        matches.push_back(DMatch(row, column, isHamming ? bestDistance : sqrt(bestDistance)));
+    }
+}
+
+void AGDescriptorMatcher::matchGuidedMutualNearestNeighbours(const Mat &descriptorsOne,
+                                                             const Mat &descriptorsTwo,
+                                                             const vector<KeyPoint> &keypointsOne,
+                                                             const vector<KeyPoint> &keypointsTwo,
+                                                             const Point2f &predictedShift,
+                                                             const Size2f &searchRadius,
+                                                             float ratio,
+                                                             vector<DMatch> &matches,
+                                                             int normType)
+{
+    matches.clear();
+    if (descriptorsOne.empty() || descriptorsTwo.empty() || descriptorsOne.cols != descriptorsTwo.cols
+        || (int)keypointsOne.size() != descriptorsOne.rows || (int)keypointsTwo.size() != descriptorsTwo.rows
+        || searchRadius.width <= 0 || searchRadius.height <= 0) {
+        return;
+    }
+    if (normType == NORM_HAMMING) {
+        if (descriptorsOne.type() != CV_8U || descriptorsTwo.type() != CV_8U) {
+            return;
+        }
+        AGDescriptorMatcher::findGuidedMutualNearestNeighbours<uchar, &AGDescriptorMatcher::hammingDistance>(
+            descriptorsOne, descriptorsTwo, keypointsOne, keypointsTwo, predictedShift, searchRadius, ratio, matches);
+        return;
+    }
+    if (descriptorsOne.type() == CV_8U && descriptorsTwo.type() == CV_8U) {
+        AGDescriptorMatcher::findGuidedMutualNearestNeighbours<uchar, &AGDescriptorMatcher::squaredDistance>(
+            descriptorsOne, descriptorsTwo, keypointsOne, keypointsTwo, predictedShift, searchRadius, ratio * ratio, matches);
+    }
+    else {
+        Mat one = descriptorsOne, two = descriptorsTwo;
+        if (one.type() != CV_32F) {
+            descriptorsOne.convertTo(one, CV_32F);
+        }
+        if (two.type() != CV_32F) {
+            descriptorsTwo.convertTo(two, CV_32F);
+        }
+        AGDescriptorMatcher::findGuidedMutualNearestNeighbours<float, &AGDescriptorMatcher::squaredDistance>(
+            one, two, keypointsOne, keypointsTwo, predictedShift, searchRadius, ratio * ratio, matches);
+    }
+    AGDescriptorMatcher::takeSquareRootOfDistances(matches);
+}
+
+template <typename T, float (*Distance)(const T *, const T *, int)>
+void AGDescriptorMatcher::findGuidedMutualNearestNeighbours(const Mat &one,
+                                                            const Mat &two,
+                                                            const vector<KeyPoint> &keypointsOne,
+                                                            const vector<KeyPoint> &keypointsTwo,
+                                                            const Point2f &predictedShift,
+                                                            const Size2f &searchRadius,
+                                                            float distanceRatio,
+                                                            vector<DMatch> &matches)
+{
+    // Hashing keypoints of second set into grid (indices of keypoints are stored cell after cell)
+    float minimalX = FLT_MAX, minimalY = FLT_MAX, maximalX = -FLT_MAX, maximalY = -FLT_MAX;
+    for (auto &keypoint : keypointsTwo) {
+        minimalX = min(minimalX, keypoint.pt.x);
+        minimalY = min(minimalY, keypoint.pt.y);
+        maximalX = max(maximalX, keypoint.pt.x);
+        maximalY = max(maximalY, keypoint.pt.y);
+    }
+    float cellWidth = max(searchRadius.width, (maximalX - minimalX) / GUIDED_MATCHING_MAXIMAL_GRID_SIZE);
+    float cellHeight = max(searchRadius.height, (maximalY - minimalY) / GUIDED_MATCHING_MAXIMAL_GRID_SIZE);
+    int gridWidth = (int)((maximalX - minimalX) / cellWidth) + 1;
+    int gridHeight = (int)((maximalY - minimalY) / cellHeight) + 1;
+
+    int numberOfKeypointsTwo = (int)keypointsTwo.size();
+    vector<int> cellOfKeypoint(numberOfKeypointsTwo);
+    vector<int> cellStart(gridWidth * gridHeight + 1, 0);
+    for (int i = 0; i < numberOfKeypointsTwo; ++i) {
+        int cellX = min((int)((keypointsTwo[i].pt.x - minimalX) / cellWidth), gridWidth - 1);
+        int cellY = min((int)((keypointsTwo[i].pt.y - minimalY) / cellHeight), gridHeight - 1);
+        cellOfKeypoint[i] = cellY * gridWidth + cellX;
+        cellStart[cellOfKeypoint[i] + 1]++;
+    }
+    for (int cell = 0; cell < gridWidth * gridHeight; ++cell) {
+        cellStart[cell + 1] += cellStart[cell];
+    }
+    vector<int> keypointsInCells(numberOfKeypointsTwo);
+    vector<int> cellFill(cellStart.begin(), cellStart.end() - 1);
+    for (int i = 0; i < numberOfKeypointsTwo; ++i) {
+        keypointsInCells[cellFill[cellOfKeypoint[i]]++] = i;
+    }
+
+    int length = one.cols;
+    vector<float> rowBest(one.rows, FLT_MAX), rowSecondBest(one.rows, FLT_MAX), columnBest(two.rows, FLT_MAX);
+    vector<int> rowBestIndex(one.rows, -1), columnBestIndex(two.rows, -1);
+
+    for (int row = 0; row < one.rows; ++row) {
+        Point2f predictedPoint = keypointsOne[row].pt + predictedShift;
+        int firstCellX = max((int)floor((predictedPoint.x - searchRadius.width - minimalX) / cellWidth), 0);
+        int lastCellX = min((int)floor((predictedPoint.x + searchRadius.width - minimalX) / cellWidth), gridWidth - 1);
+        int firstCellY = max((int)floor((predictedPoint.y - searchRadius.height - minimalY) / cellHeight), 0);
+        int lastCellY = min((int)floor((predictedPoint.y + searchRadius.height - minimalY) / cellHeight), gridHeight - 1);
+        const T *descriptorOne = one.ptr<T>(row);
+        for (int cellY = firstCellY; cellY <= lastCellY; ++cellY) {
+            for (int cellX = firstCellX; cellX <= lastCellX; ++cellX) {
+                int cell = cellY * gridWidth + cellX;
+                for (int i = cellStart[cell]; i < cellStart[cell + 1]; ++i) {
+                    int column = keypointsInCells[i];
+                    const Point2f &pointTwo = keypointsTwo[column].pt;
+                    if (abs(pointTwo.x - predictedPoint.x) >= searchRadius.width
+                        || abs(pointTwo.y - predictedPoint.y) >= searchRadius.height) {
+                        continue;
+                    }
+                    float distance = Distance(descriptorOne, two.ptr<T>(column), length);
+                    if (distance < rowBest[row]
+                        || (distance == rowBest[row] && column < rowBestIndex[row])) {
+                        rowSecondBest[row] = rowBest[row];
+                        rowBest[row] = distance;
+                        rowBestIndex[row] = column;
+                    }
+                    else if (distance < rowSecondBest[row]) {
+                        rowSecondBest[row] = distance;
+                    }
+                    if (distance < columnBest[column]) {
+                        columnBest[column] = distance;
+                        columnBestIndex[column] = row;
+                    }
+                }
+            }
+        }
+    }
+
+    for (int row = 0; row < one.rows; ++row) {
+        int column = rowBestIndex[row];
+        if (column < 0 || columnBestIndex[column] != row) {
+            continue;
+        }
+        if (distanceRatio < 1.0f && rowSecondBest[row] != FLT_MAX
+            && rowBest[row] >= distanceRatio * rowSecondBest[row]) {
+            continue;
+        }
+        matches.push_back(DMatch(row, column, rowBest[row]));
+    }
+}
+
+float AGDescriptorMatcher::squaredDistance(const float *descriptorOne, const float *descriptorTwo, int length)
+{
+    int i = 0;
+    float sum = 0.0f;
+#if defined(__AVX2__)
+    __m256 sums = _mm256_setzero_ps();
+    for (; i <= length - 8; i += 8) {
+        __m256 difference = _mm256_sub_ps(_mm256_loadu_ps(descriptorOne + i), _mm256_loadu_ps(descriptorTwo + i));
+        sums = _mm256_add_ps(sums, _mm256_mul_ps(difference, difference));
+    }
+    __m128 halfSums = _mm_add_ps(_mm256_castps256_ps128(sums), _mm256_extractf128_ps(sums, 1));
+    halfSums = _mm_add_ps(halfSums, _mm_movehl_ps(halfSums, halfSums));
+    halfSums = _mm_add_ss(halfSums, _mm_shuffle_ps(halfSums, halfSums, 1));
+    sum = _mm_cvtss_f32(halfSums);
+#elif defined(__SSE2__)
+    __m128 sums = _mm_setzero_ps();
+    for (; i <= length - 4; i += 4) {
+        __m128 difference = _mm_sub_ps(_mm_loadu_ps(descriptorOne + i), _mm_loadu_ps(descriptorTwo + i));
+        sums = _mm_add_ps(sums, _mm_mul_ps(difference, difference));
+    }
+    sums = _mm_add_ps(sums, _mm_movehl_ps(sums, sums));
+    sums = _mm_add_ss(sums, _mm_shuffle_ps(sums, sums, 1));
+    sum = _mm_cvtss_f32(sums);
+#endif
+    for (; i < length; ++i) {
+        float difference = descriptorOne[i] - descriptorTwo[i];
+        sum += difference * difference;
+    }
+    return sum;
+}
+
+float AGDescriptorMatcher::squaredDistance(const uchar *descriptorOne, const uchar *descriptorTwo, int length)
+{
+    // Differences are widened to 16 bits and squared and summed in pairs (madd), so sums are exact integers
+    int i = 0;
+    int sum = 0;
+#if defined(__AVX2__)
+    __m256i sums = _mm256_setzero_si256();
+    for (; i <= length - 16; i += 16) {
+        __m256i wordsOne = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(descriptorOne + i)));
+        __m256i wordsTwo = _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *)(descriptorTwo + i)));
+        __m256i difference = _mm256_sub_epi16(wordsOne, wordsTwo);
+        sums = _mm256_add_epi32(sums, _mm256_madd_epi16(difference, difference));
+    }
+    __m128i halfSums = _mm_add_epi32(_mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1));
+    halfSums = _mm_add_epi32(halfSums, _mm_shuffle_epi32(halfSums, _MM_SHUFFLE(1, 0, 3, 2)));
+    halfSums = _mm_add_epi32(halfSums, _mm_shuffle_epi32(halfSums, _MM_SHUFFLE(2, 3, 0, 1)));
+    sum = _mm_cvtsi128_si32(halfSums);
+#elif defined(__SSE2__)
+    __m128i zero = _mm_setzero_si128();
+    __m128i sums = _mm_setzero_si128();
+    for (; i <= length - 16; i += 16) {
+        __m128i bytesOne = _mm_loadu_si128((const __m128i *)(descriptorOne + i));
+        __m128i bytesTwo = _mm_loadu_si128((const __m128i *)(descriptorTwo + i));
+        __m128i lowDifference = _mm_sub_epi16(_mm_unpacklo_epi8(bytesOne, zero), _mm_unpacklo_epi8(bytesTwo, zero));
+        __m128i highDifference = _mm_sub_epi16(_mm_unpackhi_epi8(bytesOne, zero), _mm_unpackhi_epi8(bytesTwo, zero));
+        sums = _mm_add_epi32(sums, _mm_madd_epi16(lowDifference, lowDifference));
+        sums = _mm_add_epi32(sums, _mm_madd_epi16(highDifference, highDifference));
+    }
+    sums = _mm_add_epi32(sums, _mm_shuffle_epi32(sums, _MM_SHUFFLE(1, 0, 3, 2)));
+    sums = _mm_add_epi32(sums, _mm_shuffle_epi32(sums, _MM_SHUFFLE(2, 3, 0, 1)));
+    sum = _mm_cvtsi128_si32(sums);
+#endif
+    for (; i < length; ++i) {
+        int difference = (int)descriptorOne[i] - (int)descriptorTwo[i];
+        sum += difference * difference;
+    }
+    return (float)sum;
+}
+
+float AGDescriptorMatcher::hammingDistance(const uchar *descriptorOne, const uchar *descriptorTwo, int length)
+{
+    int i = 0;
+    int sum = 0;
+#if defined(__AVX2__)
+    // Bits of every nibble are counted with lookup table (shuffle) and bytes are summed with SAD
+    const __m256i lookupTable = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                                 0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i lowNibbleMask = _mm256_set1_epi8(0x0f);
+    __m256i sums = _mm256_setzero_si256();
+    for (; i <= length - 32; i += 32) {
+        __m256i bits = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)(descriptorOne + i)),
+                                        _mm256_loadu_si256((const __m256i *)(descriptorTwo + i)));
+        __m256i lowCounts = _mm256_shuffle_epi8(lookupTable, _mm256_and_si256(bits, lowNibbleMask));
+        __m256i highCounts = _mm256_shuffle_epi8(lookupTable, _mm256_and_si256(_mm256_srli_epi16(bits, 4), lowNibbleMask));
+        sums = _mm256_add_epi64(sums, _mm256_sad_epu8(_mm256_add_epi8(lowCounts, highCounts), _mm256_setzero_si256()));
+    }
+    __m128i halfSums = _mm_add_epi64(_mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1));
+    halfSums = _mm_add_epi64(halfSums, _mm_unpackhi_epi64(halfSums, halfSums));
+    sum = _mm_cvtsi128_si32(halfSums);
+#endif
+    for (; i <= length - 8; i += 8) {
+        uint64_t wordOne, wordTwo;
+        memcpy(&wordOne, descriptorOne + i, sizeof(wordOne));
+        memcpy(&wordTwo, descriptorTwo + i, sizeof(wordTwo));
+        sum += __builtin_popcountll(wordOne ^ wordTwo);
+    }
+    for (; i < length; ++i) {
+        sum += __builtin_popcount(descriptorOne[i] ^ descriptorTwo[i]);
+    }
+    return (float)sum;
+}
+
+void AGDescriptorMatcher::takeSquareRootOfDistances(vector<DMatch> &matches)
+{
+    for (auto &match : matches) {
+        match.distance = sqrt(match.distance);
+    }
+}
+
+#pragma mark -
+#pragma mark Quantization
+
+void AGDescriptorMatcher::quantizeDescriptors(const Mat &descriptors, Mat &quantizedDescriptors)
+{
+    if (descriptors.empty() || descriptors.depth() == CV_8U) {
+        quantizedDescriptors = descriptors;
+        return;
+    }
+    descriptors.convertTo(quantizedDescriptors, CV_8U);
+}
+
+#pragma mark -
+#pragma mark Testing
+
+double AGDescriptorMatcher::recallOfMatches(const vector<DMatch> &matches, const vector<DMatch> &referenceMatches)
+{
+    if (referenceMatches.empty()) {
+        return 1.0;
+    }
+    map<int, int> trainIndexOfQuery;
+    for (auto &match : matches) {
+        trainIndexOfQuery[match.queryIdx] = match.trainIdx;
+    }
+    int numberOfFoundMatches = 0;
+    for (auto &referenceMatch : referenceMatches) {
+        auto iterator = trainIndexOfQuery.find(referenceMatch.queryIdx);
+        if (iterator != trainIndexOfQuery.end() && iterator->second == referenceMatch.trainIdx) {
+            numberOfFoundMatches++;
+        }
+    }
+    return (double)numberOfFoundMatches / referenceMatches.size();
+}
+
+void AGDescriptorMatcher::testMatchingBackends(const Mat &descriptorsOne, const Mat &descriptorsTwo)
+{
+    int64 start = getTickCount();
+    vector<DMatch> exactMatches;
+    AGDescriptorMatcher::matchMutualNearestNeighbours(descriptorsOne, descriptorsTwo, 1.0f, exactMatches);
+    double exactTime = (getTickCount() - start) / getTickFrequency();
+
+    start = getTickCount();
+    vector<DMatch> approximateMatches;
+    AGDescriptorMatcher::matchMutualNearestNeighboursWithFLANN(descriptorsOne, descriptorsTwo, 1.0f, approximateMatches);
+    double approximateTime = (getTickCount() - start) / getTickFrequency();
+
+    Mat quantizedOne, quantizedTwo;
+    AGDescriptorMatcher::quantizeDescriptors(descriptorsOne, quantizedOne);
+    AGDescriptorMatcher::quantizeDescriptors(descriptorsTwo, quantizedTwo);
+    start = getTickCount();
+    vector<DMatch> quantizedMatches;
+    AGDescriptorMatcher::matchMutualNearestNeighbours(quantizedOne, quantizedTwo, 1.0f, quantizedMatches);
+    double quantizedTime = (getTickCount() - start) / getTickFrequency();
+
+    cout << "Keypoints: " << descriptorsOne.rows << " x " << descriptorsTwo.rows << endl;
+    cout << "Brute force matching: " << exactTime << " s (" << exactMatches.size() << " matches)" << endl;
+    cout << "FLANN matching: " << approximateTime << " s (" << approximateMatches.size() << " matches, recall "
+         << AGDescriptorMatcher::recallOfMatches(approximateMatches, exactMatches) << ")" << endl;
+    cout << "Quantized (uint8) matching: " << quantizedTime << " s (" << quantizedMatches.size() << " matches, recall "
+         << AGDescriptorMatcher::recallOfMatches(quantizedMatches, exactMatches) << ")" << endl << endl;
+}
+
+void AGDescriptorMatcher::testMatchingPerformance(const Mat &descriptorsOne, const Mat &descriptorsTwo)
+{
+    int64 start = getTickCount();
+    vector<DMatch> matchesOne, matchesTwo;
+    BFMatcher bfMatcherOne, bfMatcherTwo;
+    bfMatcherOne.match(descriptorsOne, descriptorsTwo, matchesOne);
+    bfMatcherTwo.match(descriptorsTwo, descriptorsOne, matchesTwo);
+    int numberOfReferenceMatches = 0;
+    for (auto &match : matchesOne) {
+        if (matchesTwo[match.trainIdx].trainIdx == match.queryIdx) {
+            numberOfReferenceMatches++;
+        }
+    }
+    double referenceTime = (getTickCount() - start) / getTickFrequency();
+
+    start = getTickCount();
+    vector<DMatch> matches;
+    AGDescriptorMatcher::matchMutualNearestNeighbours(descriptorsOne, descriptorsTwo, 1.0f, matches);
+    double time = (getTickCount() - start) / getTickFrequency();
+
+    int numberOfCommonMatches = 0;
+    for (auto &match : matches) {
+        if (matchesOne[match.queryIdx].trainIdx == match.trainIdx) {
+            numberOfCommonMatches++;
+        }
+    }
+    cout << "Matching with two BFMatchers: " << referenceTime << " s (" << numberOfReferenceMatches << " mutual matches)" << endl;
+    cout << "Matching with blocked matcher: " << time << " s (speedup " << referenceTime / time << "x, "
+         << matches.size() << " mutual matches, " << numberOfCommonMatches << " common)" << endl << endl;
+}
@@ -0,0 +1,203 @@
+//
+//  Created by Aleksander Grzyb on 21/09/15.
+//  Copyright (c) 2015 Aleksander Grzyb. All rights reserved.
+//
+
+#ifndef __Mosaic_Stitcher__AGDescriptorMatcher__
+#define __Mosaic_Stitcher__AGDescriptorMatcher__
+
+#include "AGDataStructures.h"
+
+#include <stdio.h>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+ /// Matcher of float, quantized (uint8) and binary (Hamming distance) descriptors. Distances between all descriptors are computed once (in cache sized blocks,
+ /// vectorized when SSE2/AVX2 is available) and nearest neighbours are tracked in both directions at the same time, so
+ /// mutual matches are found in a single pass. Approximate (FLANN) and guided (spatially hashed) variants are provided
+ /// for large sets of keypoints.
+
+class AGDescriptorMatcher {
+public:
+    
+    /**
+     *  Finds matches between descriptors that are nearest neighbours of each other. Every descriptor takes part in
+     *  at most one match.
+     *
+     *  @param descriptorsOne First set of descriptors (one descriptor per row, query).
+     *  @param descriptorsTwo Second set of descriptors (one descriptor per row, train).
+     *  @param ratio          Maximal ratio of distances to the nearest and the second nearest neighbour of first
+     *                        descriptor (1.0 or more disables ratio test).
+     *  @param matches        Output matches (queryIdx from first set, trainIdx from second set, distance).
+     *  @param normType       cv::NORM_L2 (float or quantized descriptors) or cv::NORM_HAMMING (binary descriptors).
+     */
+    static void matchMutualNearestNeighbours(const cv::Mat &descriptorsOne,
+                                             const cv::Mat &descriptorsTwo,
+                                             float ratio,
+                                             std::vector<cv::DMatch> &matches,
+                                             int normType = cv::NORM_L2);
+    
+    /**
+     *  Finds mutual nearest neighbours approximately, using FLANN kd-trees (or LSH tables for binary descriptors)
+     *  built on both sets of descriptors. Parameters and output are the same as in matchMutualNearestNeighbours(...).
+     *
+     *  @param descriptorsOne First set of descriptors (query).
+     *  @param descriptorsTwo Second set of descriptors (train).
+     *  @param ratio          Ratio test parameter (1.0 or more disables ratio test).
+     *  @param matches        Output matches.
+     *  @param normType       cv::NORM_L2 or cv::NORM_HAMMING.
+     */
+    static void matchMutualNearestNeighboursWithFLANN(const cv::Mat &descriptorsOne,
+                                                      const cv::Mat &descriptorsTwo,
+                                                      float ratio,
+                                                      std::vector<cv::DMatch> &matches,
+                                                      int normType = cv::NORM_L2);
+    
+    /**
+     *  Finds mutual nearest neighbours only among pairs of keypoints that agree with predicted placement of images.
+     *  Keypoints of second set are hashed into grid of cells of search window size, so every descriptor of first set
+     *  is compared only with descriptors whose keypoints lie in the window around its predicted location. Nearest
+     *  neighbours (and second nearest neighbour used in ratio test) are searched among those candidates only.
+     *
+     *  @param descriptorsOne First set of descriptors (query).
+     *  @param descriptorsTwo Second set of descriptors (train).
+     *  @param keypointsOne   Keypoints of first set of descriptors.
+     *  @param keypointsTwo   Keypoints of second set of descriptors.
+     *  @param predictedShift Predicted displacement from keypoint of first set to its counterpart in second set.
+     *  @param searchRadius   Half of width and height of search window around predicted location.
+     *  @param ratio          Ratio test parameter (1.0 or more disables ratio test).
+     *  @param matches        Output matches.
+     *  @param normType       cv::NORM_L2 or cv::NORM_HAMMING.
+     */
+    static void matchGuidedMutualNearestNeighbours(const cv::Mat &descriptorsOne,
+                                                   const cv::Mat &descriptorsTwo,
+                                                   const std::vector<cv::KeyPoint> &keypointsOne,
+                                                   const std::vector<cv::KeyPoint> &keypointsTwo,
+                                                   const cv::Point2f &predictedShift,
+                                                   const cv::Size2f &searchRadius,
+                                                   float ratio,
+                                                   std::vector<cv::DMatch> &matches,
+                                                   int normType = cv::NORM_L2);
+    
+    /**
+     *  Finds mutual nearest neighbours with backend selected in parameters.
+     *
+     *  @param descriptorsOne First set of descriptors (query).
+     *  @param descriptorsTwo Second set of descriptors (train).
+     *  @param parameters     Parameters (matchingBackend, flannKeypointsThreshold and ratioTestParameter are used).
+     *  @param matches        Output matches.
+     *  @param normType       cv::NORM_L2 or cv::NORM_HAMMING.
+     */
+    static void matchDescriptors(const cv::Mat &descriptorsOne,
+                                 const cv::Mat &descriptorsTwo,
+                                 const AGParameters &parameters,
+                                 std::vector<cv::DMatch> &matches,
+                                 int normType = cv::NORM_L2);
+    
+    /**
+     *  Converts descriptors to quantized representation (one unsigned byte per dimension). SIFT descriptors computed
+     *  by OpenCV are already rounded to integers in range 0-255, so quantization does not change them, it only takes
+     *  4 times less memory. Quantized descriptors are matched with integer distance kernels.
+     *
+     *  @param descriptors          Input descriptors.
+     *  @param quantizedDescriptors Output descriptors (CV_8U).
+     */
+    static void quantizeDescriptors(const cv::Mat &descriptors, cv::Mat &quantizedDescriptors);
+    
+    /**
+     *  Matches descriptors with every backend (and quantized descriptors) and prints execution times and recall (part
+     *  of exact float matches that were also found) (testing purpose).
+     *
+     *  @param descriptorsOne First set of descriptors.
+     *  @param descriptorsTwo Second set of descriptors.
+     */
+    static void testMatchingBackends(const cv::Mat &descriptorsOne, const cv::Mat &descriptorsTwo);
+    
+    /**
+     *  Matches descriptors with matchMutualNearestNeighbours(...) and with two BFMatcher calls, compares results and
+     *  prints execution times (testing purpose).
+     *
+     *  @param descriptorsOne First set of descriptors.
+     *  @param descriptorsTwo Second set of descriptors.
+     */
+    static void testMatchingPerformance(const cv::Mat &descriptorsOne, const cv::Mat &descriptorsTwo);
+    
+private:
+    
+    /**
+     *  Calculates squared L2 distance between two descriptors.
+     *
+     *  @param descriptorOne First descriptor.
+     *  @param descriptorTwo Second descriptor.
+     *  @param length        Number of elements of descriptor.
+     *
+     *  @return Squared distance.
+     */
+    static float squaredDistance(const float *descriptorOne, const float *descriptorTwo, int length);
+    
+    /**
+     *  Calculates squared L2 distance between two quantized descriptors (exact integer computation).
+     *
+     *  @param descriptorOne First descriptor.
+     *  @param descriptorTwo Second descriptor.
+     *  @param length        Number of elements of descriptor.
+     *
+     *  @return Squared distance.
+     */
+    static float squaredDistance(const uchar *descriptorOne, const uchar *descriptorTwo, int length);
+    
+    /**
+     *  Calculates Hamming distance between two binary descriptors (popcount of xor).
+     *
+     *  @param descriptorOne First descriptor.
+     *  @param descriptorTwo Second descriptor.
+     *  @param length        Number of bytes of descriptor.
+     *
+     *  @return Number of different bits.
+     */
+    static float hammingDistance(const uchar *descriptorOne, const uchar *descriptorTwo, int length);
+    
+    /**
+     *  Replaces squared distances of matches with distances.
+     *
+     *  @param matches Matches to update.
+     */
+    static void takeSquareRootOfDistances(std::vector<cv::DMatch> &matches);
+    
+    /**
+     *  Implementation of matchMutualNearestNeighbours(...) for descriptors of type T and distance function Distance.
+     *  Distances of output matches are values of Distance (distanceRatio is compared with them directly).
+     */
+    template <typename T, float (*Distance)(const T *, const T *, int)>
+    static void findMutualNearestNeighbours(const cv::Mat &one,
+                                            const cv::Mat &two,
+                                            float distanceRatio,
+                                            std::vector<cv::DMatch> &matches);
+    
+    /**
+     *  Implementation of matchGuidedMutualNearestNeighbours(...) for descriptors of type T and distance function
+     *  Distance. Distances of output matches are values of Distance (distanceRatio is compared with them directly).
+     */
+    template <typename T, float (*Distance)(const T *, const T *, int)>
+    static void findGuidedMutualNearestNeighbours(const cv::Mat &one,
+                                                  const cv::Mat &two,
+                                                  const std::vector<cv::KeyPoint> &keypointsOne,
+                                                  const std::vector<cv::KeyPoint> &keypointsTwo,
+                                                  const cv::Point2f &predictedShift,
+                                                  const cv::Size2f &searchRadius,
+                                                  float distanceRatio,
+                                                  std::vector<cv::DMatch> &matches);
+    
+    /**
+     *  Calculates part of reference matches that are present in matches.
+     *
+     *  @param matches          Matches to check.
+     *  @param referenceMatches Reference matches.
+     *
+     *  @return Recall (1.0 when there are no reference matches).
+     */
+    static double recallOfMatches(const std::vector<cv::DMatch> &matches,
+                                  const std::vector<cv::DMatch> &referenceMatches);
+};
+
+#endif /* defined(__Mosaic_Stitcher__AGDescriptorMatcher__) */
@@ -0,0 +1,249 @@
+//
+//  Created by Aleksander Grzyb on 21/09/15.
+//  Copyright (c) 2015 Aleksander Grzyb. All rights reserved.
+//
+
+#include "AGECCRefinement.h"
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+using namespace cv;
+using namespace std;
+
+#pragma mark -
+#pragma mark Refinement
+
+bool AGECCRefinement::refineTransform(const Mat &imageOne,
+                                      const Mat &imageTwo,
+                                      const Rect &regionOne,
+                                      AGTransformModel model,
+                                      Mat &transform,
+                                      double &correlation)
+{
+    correlation = 0.0;
+    if (!imageOne.data || !imageTwo.data || transform.rows != 2 || transform.cols != 3
+        || (regionOne & Rect(Point(0, 0), imageOne.size())) != regionOne
+        || regionOne.width < ECC_MINIMAL_REGION_SIZE || regionOne.height < ECC_MINIMAL_REGION_SIZE) {
+        return false;
+    }
+    Mat initialTransform;
+    transform.convertTo(initialTransform, CV_64F);
+
+    // Second image is read only around overlap region of first image placed by initial transform
+    vector<Point2f> corners = { Point2f(regionOne.x, regionOne.y),
+                                Point2f(regionOne.x + regionOne.width, regionOne.y),
+                                Point2f(regionOne.x, regionOne.y + regionOne.height),
+                                Point2f(regionOne.x + regionOne.width, regionOne.y + regionOne.height) };
+    vector<Point2f> transformedCorners;
+    cv::transform(corners, transformedCorners, initialTransform);
+    Rect regionTwo = boundingRect(transformedCorners);
+    regionTwo = Rect(regionTwo.x - ECC_MAXIMAL_CORRECTION, regionTwo.y - ECC_MAXIMAL_CORRECTION,
+                     regionTwo.width + 2 * ECC_MAXIMAL_CORRECTION, regionTwo.height + 2 * ECC_MAXIMAL_CORRECTION);
+    regionTwo &= Rect(Point(0, 0), imageTwo.size());
+    if (regionTwo.width < ECC_MINIMAL_REGION_SIZE || regionTwo.height < ECC_MINIMAL_REGION_SIZE) {
+        return false;
+    }
+
+    vector<Mat> templatePyramid(1), searchPyramid(1);
+    AGECCRefinement::convertRegionToFloat(imageOne, regionOne, templatePyramid[0]);
+    AGECCRefinement::convertRegionToFloat(imageTwo, regionTwo, searchPyramid[0]);
+    for (int level = 1; level <= ECC_PYRAMID_LEVELS
+         && min(templatePyramid.back().rows, templatePyramid.back().cols) >= 2 * ECC_MINIMAL_REGION_SIZE
+         && min(searchPyramid.back().rows, searchPyramid.back().cols) >= 2 * ECC_MINIMAL_REGION_SIZE; ++level) {
+        templatePyramid.push_back(Mat());
+        searchPyramid.push_back(Mat());
+        pyrDown(templatePyramid[level - 1], templatePyramid[level]);
+        pyrDown(searchPyramid[level - 1], searchPyramid[level]);
+    }
+
+    // Warp between regions: w(q) = T(q + regionOne.tl) - regionTwo.tl
+    Mat warp = initialTransform.clone();
+    Mat linearPart = initialTransform.colRange(0, 2);
+    Mat regionOneOrigin = (Mat_<double>(2, 1) << regionOne.x, regionOne.y);
+    Mat regionTwoOrigin = (Mat_<double>(2, 1) << regionTwo.x, regionTwo.y);
+    Mat(initialTransform.col(2) + linearPart * regionOneOrigin - regionTwoOrigin).copyTo(warp.col(2));
+    if (model == RigidModel) {
+        double angle = atan2(warp.at<double>(1, 0), warp.at<double>(0, 0));
+        warp.at<double>(0, 0) = warp.at<double>(1, 1) = cos(angle);
+        warp.at<double>(1, 0) = sin(angle);
+        warp.at<double>(0, 1) = -sin(angle);
+    }
+
+    // Translation at level l is scaled by 2^-l (pyrDown keeps pixel 2i of finer level at pixel i)
+    for (int level = (int)templatePyramid.size() - 1; level >= 0; --level) {
+        Mat translation = warp.col(2);
+        translation *= 1.0 / (1 << level);
+        if (!AGECCRefinement::refineWarpOnLevel(templatePyramid[level], searchPyramid[level], model, warp, correlation)) {
+            return false;
+        }
+        translation *= (1 << level);
+    }
+
+    Mat refinedTransform = warp.clone();
+    Mat(warp.col(2) + regionTwoOrigin - warp.colRange(0, 2) * regionOneOrigin).copyTo(refinedTransform.col(2));
+
+    Point2f center(regionOne.x + regionOne.width * 0.5f, regionOne.y + regionOne.height * 0.5f);
+    vector<Point2f> centers = { center }, initialCenter, refinedCenter;
+    cv::transform(centers, initialCenter, initialTransform);
+    cv::transform(centers, refinedCenter, refinedTransform);
+    Point2f correction = refinedCenter[0] - initialCenter[0];
+    if (correction.dot(correction) > ECC_MAXIMAL_CORRECTION * ECC_MAXIMAL_CORRECTION) {
+        return false;
+    }
+    transform = refinedTransform;
+    return true;
+}
+
+bool AGECCRefinement::refineWarpOnLevel(const Mat &templateImage,
+                                        const Mat &searchImage,
+                                        AGTransformModel model,
+                                        Mat &warp,
+                                        double &correlation)
+{
+    int n = AGECCRefinement::numberOfParameters(model);
+    Mat gradientX, gradientY;
+    Sobel(searchImage, gradientX, CV_32F, 1, 0, 3, 1.0 / 8.0);
+    Sobel(searchImage, gradientY, CV_32F, 0, 1, 3, 1.0 / 8.0);
+    Mat searchMask(searchImage.size(), CV_8U, Scalar(WHITE_PIXEL));
+
+    Mat warpedImage, warpedGradientX, warpedGradientY, validMask;
+    vector<double> jacobian(n);
+    double previousCorrelation = -2.0;
+    for (int iteration = 0; iteration < ECC_MAXIMAL_ITERATIONS; ++iteration) {
+        int flags = INTER_LINEAR | WARP_INVERSE_MAP;
+        warpAffine(searchImage, warpedImage, warp, templateImage.size(), flags);
+        warpAffine(gradientX, warpedGradientX, warp, templateImage.size(), flags);
+        warpAffine(gradientY, warpedGradientY, warp, templateImage.size(), flags);
+        warpAffine(searchMask, validMask, warp, templateImage.size(), INTER_NEAREST | WARP_INVERSE_MAP);
+        int numberOfValidPixels = countNonZero(validMask);
+        if (numberOfValidPixels < ECC_MINIMAL_REGION_SIZE * ECC_MINIMAL_REGION_SIZE) {
+            return false;
+        }
+        double templateMean = mean(templateImage, validMask)[0];
+        double imageMean = mean(warpedImage, validMask)[0];
+
+        // One pass accumulates Hessian, projections of zero mean template and image on Jacobian and their norms
+        Mat hessian = Mat::zeros(n, n, CV_64F);
+        Mat templateProjection = Mat::zeros(n, 1, CV_64F), imageProjection = Mat::zeros(n, 1, CV_64F);
+        double templateNorm = 0.0, imageNorm = 0.0, crossCorrelation = 0.0;
+        double a = warp.at<double>(0, 0), b = warp.at<double>(1, 0);
+        for (int y = 0; y < templateImage.rows; ++y) {
+            const uchar *mask = validMask.ptr<uchar>(y);
+            const float *templateRow = templateImage.ptr<float>(y);
+            const float *imageRow = warpedImage.ptr<float>(y);
+            const float *gradientXRow = warpedGradientX.ptr<float>(y);
+            const float *gradientYRow = warpedGradientY.ptr<float>(y);
+            for (int x = 0; x < templateImage.cols; ++x) {
+                if (!mask[x]) {
+                    continue;
+                }
+                double gx = gradientXRow[x], gy = gradientYRow[x];
+                switch (model) {
+                    case TranslationModel:
+                        jacobian[0] = gx;
+                        jacobian[1] = gy;
+                        break;
+                    case RigidModel:
+                        jacobian[0] = gx * (-b * x - a * y) + gy * (a * x - b * y);
+                        jacobian[1] = gx;
+                        jacobian[2] = gy;
+                        break;
+                    case SimilarityModel:
+                        jacobian[0] = gx * x + gy * y;
+                        jacobian[1] = gy * x - gx * y;
+                        jacobian[2] = gx;
+                        jacobian[3] = gy;
+                        break;
+                }
+                double templateValue = templateRow[x] - templateMean;
+                double imageValue = imageRow[x] - imageMean;
+                for (int i = 0; i < n; ++i) {
+                    double *hessianRow = hessian.ptr<double>(i);
+                    for (int j = 0; j <= i; ++j) {
+                        hessianRow[j] += jacobian[i] * jacobian[j];
+                    }
+                    templateProjection.at<double>(i) += jacobian[i] * templateValue;
+                    imageProjection.at<double>(i) += jacobian[i] * imageValue;
+                }
+                templateNorm += templateValue * templateValue;
+                imageNorm += imageValue * imageValue;
+                crossCorrelation += templateValue * imageValue;
+            }
+        }
+        completeSymm(hessian, true);
+        if (templateNorm <= DBL_EPSILON || imageNorm <= DBL_EPSILON) {
+            return false;
+        }
+        correlation = crossCorrelation / sqrt(templateNorm * imageNorm);
+
+        Mat inverseHessian;
+        if (invert(hessian, inverseHessian, DECOMP_CHOLESKY) == 0) {
+            return false;
+        }
+        Mat projectedImage = inverseHessian * imageProjection;
+        double lambdaNumerator = imageNorm - imageProjection.dot(projectedImage);
+        double lambdaDenominator = crossCorrelation - templateProjection.dot(projectedImage);
+        if (lambdaDenominator <= 0.0) {
+            return false;
+        }
+        double lambda = lambdaNumerator / lambdaDenominator;
+        Mat delta = inverseHessian * (lambda * templateProjection - imageProjection);
+
+        switch (model) {
+            case TranslationModel:
+                warp.at<double>(0, 2) += delta.at<double>(0);
+                warp.at<double>(1, 2) += delta.at<double>(1);
+                break;
+            case RigidModel:
+            {
+                double angle = atan2(b, a) + delta.at<double>(0);
+                warp.at<double>(0, 0) = warp.at<double>(1, 1) = cos(angle);
+                warp.at<double>(1, 0) = sin(angle);
+                warp.at<double>(0, 1) = -sin(angle);
+                warp.at<double>(0, 2) += delta.at<double>(1);
+                warp.at<double>(1, 2) += delta.at<double>(2);
+            }
+                break;
+            case SimilarityModel:
+                warp.at<double>(0, 0) += delta.at<double>(0);
+                warp.at<double>(1, 1) += delta.at<double>(0);
+                warp.at<double>(1, 0) += delta.at<double>(1);
+                warp.at<double>(0, 1) -= delta.at<double>(1);
+                warp.at<double>(0, 2) += delta.at<double>(2);
+                warp.at<double>(1, 2) += delta.at<double>(3);
+                break;
+        }
+        if (fabs(correlation - previousCorrelation) < ECC_EPSILON) {
+            break;
+        }
+        previousCorrelation = correlation;
+    }
+    return true;
+}
+
+#pragma mark -
+#pragma mark Helpers
+
+int AGECCRefinement::numberOfParameters(AGTransformModel model)
+{
+    switch (model) {
+        case TranslationModel:
+            return 2;
+        case RigidModel:
+            return 3;
+        case SimilarityModel:
+            return 4;
+    }
+    return 2;
+}
+
+void AGECCRefinement::convertRegionToFloat(const Mat &image, const Rect &region, Mat &output)
+{
+    Mat regionOfImage = image(region);
+    if (regionOfImage.channels() > 1) {
+        extractChannel(regionOfImage, regionOfImage, 0);
+    }
+    regionOfImage.convertTo(output, CV_32F);
+}
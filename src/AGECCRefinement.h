@@ -0,0 +1,80 @@
+//
+//  Created by Aleksander Grzyb on 21/09/15.
+//  Copyright (c) 2015 Aleksander Grzyb. All rights reserved.
+//
+
+#ifndef __Mosaic_Stitcher__AGECCRefinement__
+#define __Mosaic_Stitcher__AGECCRefinement__
+
+#include "AGDataStructures.h"
+
+#include <stdio.h>
+#include <opencv2/opencv.hpp>
+
+ /// Refines transform between two images by maximizing enhanced correlation coefficient (ECC, Evangelidis and
+ /// Psarakis) of overlap region of first image and second image. Only overlap region of first image and its
+ /// neighbourhood in second image are read, and Gauss-Newton iterations run coarse to fine on small pyramid of both
+ /// regions (OpenCV 2.4 has no findTransformECC).
+
+class AGECCRefinement {
+public:
+
+    /**
+     *  Refines transform that maps region of first image onto second image.
+     *
+     *  @param imageOne    First image.
+     *  @param imageTwo    Second image.
+     *  @param regionOne   Region of first image compared with second image (overlap region).
+     *  @param model       Model of refined transform (rotation of RigidModel is kept without scale).
+     *  @param transform   Initial transform (input) and refined transform (output, 2x3, CV_64F, not changed when
+     *                     refinement fails).
+     *  @param correlation Output correlation coefficient of refined transform.
+     *
+     *  @return False when iterations diverge or move region further than ECC_MAXIMAL_CORRECTION.
+     */
+    static bool refineTransform(const cv::Mat &imageOne,
+                                const cv::Mat &imageTwo,
+                                const cv::Rect &regionOne,
+                                AGTransformModel model,
+                                cv::Mat &transform,
+                                double &correlation);
+
+private:
+
+    /**
+     *  Runs ECC iterations on one level of pyramid.
+     *
+     *  @param templateImage Region of first image (CV_32F).
+     *  @param searchImage   Region of second image (CV_32F).
+     *  @param model         Model of transform.
+     *  @param warp          Warp from template to search image coordinates (input and output, 2x3, CV_64F).
+     *  @param correlation   Output correlation coefficient of last iteration.
+     *
+     *  @return False when iterations diverge.
+     */
+    static bool refineWarpOnLevel(const cv::Mat &templateImage,
+                                  const cv::Mat &searchImage,
+                                  AGTransformModel model,
+                                  cv::Mat &warp,
+                                  double &correlation);
+
+    /**
+     *  Returns number of parameters of warp.
+     *
+     *  @param model Model of transform.
+     *
+     *  @return 2 for TranslationModel, 3 for RigidModel, 4 for SimilarityModel.
+     */
+    static int numberOfParameters(AGTransformModel model);
+
+    /**
+     *  Converts region of image to single channel float image.
+     *
+     *  @param image  Input image.
+     *  @param region Region of image.
+     *  @param output Output image (CV_32F).
+     */
+    static void convertRegionToFloat(const cv::Mat &image, const cv::Rect &region, cv::Mat &output);
+};
+
+#endif /* defined(__Mosaic_Stitcher__AGECCRefinement__) */
@@ -0,0 +1,82 @@
+//
+//  Created by Aleksander Grzyb on 21/09/15.
+//  Copyright (c) 2015 Aleksander Grzyb. All rights reserved.
+//
+
+#include "AGFeatureCache.h"
+
+#include <tuple>
+
+using namespace cv;
+using namespace std;
+using namespace detail;
+
+bool AGFeatureKey::operator<(const AGFeatureKey &other) const
+{
+    return tie(this->tileName, this->tileSize.width, this->tileSize.height, this->side, this->percentOverlap, this->detector) <
+           tie(other.tileName, other.tileSize.width, other.tileSize.height, other.side, other.percentOverlap, other.detector);
+}
+
+#pragma mark -
+#pragma mark Initialization
+
+AGFeatureCache::AGFeatureCache()
+{
+    this->hits = 0;
+    this->misses = 0;
+}
+
+#pragma mark -
+#pragma mark Features
+
+void AGFeatureCache::featuresForKey(const AGFeatureKey &key,
+                                    const function<void(ImageFeatures &)> &computeFeatures,
+                                    ImageFeatures &features)
+{
+    promise<ImageFeatures> computedFeatures;
+    shared_future<ImageFeatures> storedFeatures;
+    bool shouldCompute = false;
+    {
+        lock_guard<std::mutex> lock(this->mutex);
+        auto iterator = this->features.find(key);
+        if (iterator == this->features.end()) {
+            storedFeatures = computedFeatures.get_future().share();
+            this->features[key] = storedFeatures;
+            shouldCompute = true;
+            this->misses++;
+        }
+        else {
+            storedFeatures = iterator->second;
+            this->hits++;
+        }
+    }
+    if (shouldCompute) {
+        try {
+            ImageFeatures newFeatures;
+            computeFeatures(newFeatures);
+            computedFeatures.set_value(newFeatures);
+        }
+        catch (...) {
+            computedFeatures.set_exception(current_exception());
+        }
+    }
+    features = storedFeatures.get();
+}
+
+void AGFeatureCache::clear()
+{
+    lock_guard<std::mutex> lock(this->mutex);
+    this->features.clear();
+    this->hits = 0;
+    this->misses = 0;
+}
+
+long AGFeatureCache::numberOfHits() const
+{
+    return this->hits;
+}
+
+long AGFeatureCache::numberOfMisses() const
+{
+    return this->misses;
+}
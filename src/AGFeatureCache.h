@@ -0,0 +1,116 @@
+//
+//  Created by Aleksander Grzyb on 21/09/15.
+//  Copyright (c) 2015 Aleksander Grzyb. All rights reserved.
+//
+
+#ifndef __Mosaic_Stitcher__AGFeatureCache__
+#define __Mosaic_Stitcher__AGFeatureCache__
+
+#include "AGDataStructures.h"
+
+#include <stdio.h>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <future>
+#include <functional>
+#include <opencv2/stitching/stitcher.hpp>
+
+ /// Identifies features extracted from overlap region of one tile.
+
+struct AGFeatureKey {
+    
+    /**
+     *  Name of the tile (unique within one mosaic).
+     */
+    std::string tileName;
+    
+    /**
+     *  Size of the tile.
+     */
+    cv::Size tileSize;
+    
+    /**
+     *  Side of the tile from which features were extracted.
+     */
+    ImageDirection side;
+    
+    /**
+     *  Overlap between neighbouring tiles (defines size of overlap region).
+     */
+    double percentOverlap;
+    
+    /**
+     *  Description of the detector and its parameters.
+     */
+    std::string detector;
+    
+    bool operator<(const AGFeatureKey &other) const;
+};
+
+ /// Thread safe store of features extracted from overlap regions of tiles. Features of every region are computed
+ /// once and shared by all registrations (and all stitching versions) of the same mosaic.
+
+class AGFeatureCache {
+public:
+    
+    /**
+     *  Constructor of AGFeatureCache object.
+     */
+    AGFeatureCache();
+    
+    /**
+     *  Returns features stored under given key. When there are no such features, they are computed with given
+     *  function and stored. When other thread is computing the same features, waits for its result.
+     *
+     *  @param key             Key of features.
+     *  @param computeFeatures Function that computes features.
+     *  @param features        Output features (keypoints in tile coordinates).
+     */
+    void featuresForKey(const AGFeatureKey &key,
+                        const std::function<void(cv::detail::ImageFeatures &)> &computeFeatures,
+                        cv::detail::ImageFeatures &features);
+    
+    /**
+     *  Removes all stored features and resets counters.
+     */
+    void clear();
+    
+    /**
+     *  Returns number of requests served from the cache.
+     *
+     *  @return Number of hits.
+     */
+    long numberOfHits() const;
+    
+    /**
+     *  Returns number of requests that required computing features.
+     *
+     *  @return Number of misses.
+     */
+    long numberOfMisses() const;
+    
+private:
+    
+    /**
+     *  Stored features (or features being computed).
+     */
+    std::map<AGFeatureKey, std::shared_future<cv::detail::ImageFeatures>> features;
+    
+    /**
+     *  Guards features map.
+     */
+    std::mutex mutex;
+    
+    /**
+     *  Number of requests served from the cache.
+     */
+    std::atomic<long> hits;
+    
+    /**
+     *  Number of requests that required computing features.
+     */
+    std::atomic<long> misses;
+};
+
+#endif /* defined(__Mosaic_Stitcher__AGFeatureCache__) */
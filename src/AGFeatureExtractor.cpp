@@ -0,0 +1,171 @@
+//
+//  Created by Aleksander Grzyb on 21/09/15.
+//  Copyright (c) 2015 Aleksander Grzyb. All rights reserved.
+//
+
+#include "AGFeatureExtractor.h"
+
+#include <opencv2/nonfree/features2d.hpp>
+#include <sstream>
+#include <cmath>
+#include <algorithm>
+
+using namespace cv;
+using namespace std;
+
+#pragma mark -
+#pragma mark Creating Extractor
+
+shared_ptr<AGFeatureExtractor> AGFeatureExtractor::createFeatureExtractor(const string &name, AGError &error)
+{
+    if (name == "sift") {
+        return make_shared<AGSIFTFeatureExtractor>();
+    }
+    if (name == "orb") {
+        return make_shared<AGORBFeatureExtractor>();
+    }
+    if (name == "brisk") {
+        return make_shared<AGBRISKFeatureExtractor>();
+    }
+    error = { true, "createFeatureExtractor: unknown features extractor \"" + name + "\"." };
+    return nullptr;
+}
+
+#pragma mark -
+#pragma mark Selecting Keypoints
+
+void AGFeatureExtractor::selectKeypointsInGrid(vector<KeyPoint> &keypoints,
+                                               Mat &descriptors,
+                                               const Rect &region,
+                                               int budget)
+{
+    int numberOfKeypoints = (int)keypoints.size();
+    if (budget <= 0 || numberOfKeypoints <= budget || region.area() <= 0 || descriptors.rows != numberOfKeypoints) {
+        return;
+    }
+    double cellSize = max(sqrt((double)region.area() / budget), 1.0);
+    int gridWidth = (int)ceil(region.width / cellSize);
+    int gridHeight = (int)ceil(region.height / cellSize);
+
+    vector<int> cellOfKeypoint(numberOfKeypoints);
+    for (int i = 0; i < numberOfKeypoints; ++i) {
+        int cellX = min(max((int)((keypoints[i].pt.x - region.x) / cellSize), 0), gridWidth - 1);
+        int cellY = min(max((int)((keypoints[i].pt.y - region.y) / cellSize), 0), gridHeight - 1);
+        cellOfKeypoint[i] = cellY * gridWidth + cellX;
+    }
+
+    // Rank of keypoint in its cell (0 for the strongest one)
+    vector<int> order(numberOfKeypoints);
+    for (int i = 0; i < numberOfKeypoints; ++i) {
+        order[i] = i;
+    }
+    stable_sort(order.begin(), order.end(), [&](int first, int second) {
+        return keypoints[first].response > keypoints[second].response;
+    });
+    vector<int> rankOfKeypoint(numberOfKeypoints);
+    vector<int> numberOfKeypointsInCell(gridWidth * gridHeight, 0);
+    for (int index : order) {
+        rankOfKeypoint[index] = numberOfKeypointsInCell[cellOfKeypoint[index]]++;
+    }
+    // Order by response is kept within every round
+    stable_sort(order.begin(), order.end(), [&](int first, int second) {
+        return rankOfKeypoint[first] < rankOfKeypoint[second];
+    });
+    order.resize(budget);
+    sort(order.begin(), order.end());
+
+    vector<KeyPoint> selectedKeypoints(budget);
+    Mat selectedDescriptors(budget, descriptors.cols, descriptors.type());
+    for (int i = 0; i < budget; ++i) {
+        selectedKeypoints[i] = keypoints[order[i]];
+        descriptors.row(order[i]).copyTo(selectedDescriptors.row(i));
+    }
+    keypoints.swap(selectedKeypoints);
+    descriptors = selectedDescriptors;
+}
+
+#pragma mark -
+#pragma mark SIFT
+
+void AGSIFTFeatureExtractor::detectAndCompute(const Mat &image,
+                                              const Mat &mask,
+                                              vector<KeyPoint> &keypoints,
+                                              Mat &descriptors) const
+{
+    SIFT featuresFinder = SIFT::SIFT(SIFT_NUMBER_OF_FEATURES,
+                                     SIFT_NUMBER_OF_OCTAVE_LAYERS,
+                                     SIFT_CONTRAST_THRESHOLD,
+                                     SIFT_EDGE_THRESHOLD,
+                                     SIFT_SIGMA);
+//    SiftFeatureDetector featuresFinder = SiftFeatureDetector(0, 3, 0.04, 10, 1.5);
+    featuresFinder(image, mask, keypoints, descriptors);
+}
+
+int AGSIFTFeatureExtractor::normType() const
+{
+    return NORM_L2;
+}
+
+string AGSIFTFeatureExtractor::description() const
+{
+    stringstream description;
+    description << "SIFT(" << SIFT_NUMBER_OF_FEATURES << "," << SIFT_NUMBER_OF_OCTAVE_LAYERS << ","
+                << SIFT_CONTRAST_THRESHOLD << "," << SIFT_EDGE_THRESHOLD << "," << SIFT_SIGMA << ")";
+    return description.str();
+}
+
+#pragma mark -
+#pragma mark ORB
+
+void AGORBFeatureExtractor::detectAndCompute(const Mat &image,
+                                             const Mat &mask,
+                                             vector<KeyPoint> &keypoints,
+                                             Mat &descriptors) const
+{
+    ORB featuresFinder(ORB_NUMBER_OF_FEATURES,
+                       ORB_SCALE_FACTOR,
+                       ORB_NUMBER_OF_LEVELS,
+                       ORB_EDGE_THRESHOLD,
+                       0,
+                       2,
+                       ORB::HARRIS_SCORE,
+                       ORB_PATCH_SIZE);
+    featuresFinder(image, mask, keypoints, descriptors);
+}
+
+int AGORBFeatureExtractor::normType() const
+{
+    return NORM_HAMMING;
+}
+
+string AGORBFeatureExtractor::description() const
+{
+    stringstream description;
+    description << "ORB(" << ORB_NUMBER_OF_FEATURES << "," << ORB_SCALE_FACTOR << "," << ORB_NUMBER_OF_LEVELS << ","
+                << ORB_EDGE_THRESHOLD << "," << ORB_PATCH_SIZE << ")";
+    return description.str();
+}
+
+#pragma mark -
+#pragma mark BRISK
+
+void AGBRISKFeatureExtractor::detectAndCompute(const Mat &image,
+                                               const Mat &mask,
+                                               vector<KeyPoint> &keypoints,
+                                               Mat &descriptors) const
+{
+    BRISK featuresFinder(BRISK_THRESHOLD, BRISK_NUMBER_OF_OCTAVES, BRISK_PATTERN_SCALE);
+    featuresFinder(image, mask, keypoints, descriptors);
+}
+
+int AGBRISKFeatureExtractor::normType() const
+{
+    return NORM_HAMMING;
+}
+
+string AGBRISKFeatureExtractor::description() const
+{
+    stringstream description;
+    description << "BRISK(" << BRISK_THRESHOLD << "," << BRISK_NUMBER_OF_OCTAVES << "," << BRISK_PATTERN_SCALE << ")";
+    return description.str();
+}
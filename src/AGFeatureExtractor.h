@@ -0,0 +1,124 @@
+//
+//  Created by Aleksander Grzyb on 21/09/15.
+//  Copyright (c) 2015 Aleksander Grzyb. All rights reserved.
+//
+
+#ifndef __Mosaic_Stitcher__AGFeatureExtractor__
+#define __Mosaic_Stitcher__AGFeatureExtractor__
+
+#include "AGDataStructures.h"
+
+#include <stdio.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+ /// Interface of features detectors and descriptors used by AGMosaicStitcher. Implementations keep only parameters
+ /// (detector is created on every call), so one extractor can be used by many threads at the same time.
+
+class AGFeatureExtractor {
+public:
+    
+    virtual ~AGFeatureExtractor() {}
+    
+    /**
+     *  Creates extractor with given name.
+     *
+     *  @param name  Name of extractor ("sift", "orb" or "brisk").
+     *  @param error Return error.
+     *
+     *  @return Extractor (nullptr when name is not known).
+     */
+    static std::shared_ptr<AGFeatureExtractor> createFeatureExtractor(const std::string &name, AGError &error);
+    
+    /**
+     *  Keeps at most budget keypoints spread evenly over region. Region is divided into grid of about budget square
+     *  cells and keypoints are taken in rounds: the strongest keypoint of every cell, then the second strongest and
+     *  so on, so strong keypoints clustered in one place (e.g. on vessel junctions) do not take the whole budget.
+     *  Descriptors of kept keypoints are kept (order of keypoints does not change).
+     *
+     *  @param keypoints   Keypoints (input and output).
+     *  @param descriptors Descriptors of keypoints, one per row (input and output).
+     *  @param region      Region in which keypoints were detected.
+     *  @param budget      Maximal number of keypoints (0 means no limit).
+     */
+    static void selectKeypointsInGrid(std::vector<cv::KeyPoint> &keypoints,
+                                      cv::Mat &descriptors,
+                                      const cv::Rect &region,
+                                      int budget);
+    
+    /**
+     *  Detects keypoints in image and computes their descriptors.
+     *
+     *  @param image       Input image (single channel).
+     *  @param mask        Mask of region in which keypoints are detected.
+     *  @param keypoints   Output keypoints.
+     *  @param descriptors Output descriptors (one per row).
+     */
+    virtual void detectAndCompute(const cv::Mat &image,
+                                  const cv::Mat &mask,
+                                  std::vector<cv::KeyPoint> &keypoints,
+                                  cv::Mat &descriptors) const = 0;
+    
+    /**
+     *  Returns norm used for matching descriptors.
+     *
+     *  @return cv::NORM_L2 (float descriptors) or cv::NORM_HAMMING (binary descriptors).
+     */
+    virtual int normType() const = 0;
+    
+    /**
+     *  Returns description of extractor and its parameters (part of the feature cache key).
+     *
+     *  @return Description of extractor.
+     */
+    virtual std::string description() const = 0;
+};
+
+ /// SIFT detector and descriptor (nonfree module).
+
+class AGSIFTFeatureExtractor : public AGFeatureExtractor {
+public:
+    
+    void detectAndCompute(const cv::Mat &image,
+                          const cv::Mat &mask,
+                          std::vector<cv::KeyPoint> &keypoints,
+                          cv::Mat &descriptors) const;
+    
+    int normType() const;
+    
+    std::string description() const;
+};
+
+ /// ORB detector with binary descriptor.
+
+class AGORBFeatureExtractor : public AGFeatureExtractor {
+public:
+    
+    void detectAndCompute(const cv::Mat &image,
+                          const cv::Mat &mask,
+                          std::vector<cv::KeyPoint> &keypoints,
+                          cv::Mat &descriptors) const;
+    
+    int normType() const;
+    
+    std::string description() const;
+};
+
+ /// BRISK detector with binary descriptor.
+
+class AGBRISKFeatureExtractor : public AGFeatureExtractor {
+public:
+    
+    void detectAndCompute(const cv::Mat &image,
+                          const cv::Mat &mask,
+                          std::vector<cv::KeyPoint> &keypoints,
+                          cv::Mat &descriptors) const;
+    
+    int normType() const;
+    
+    std::string description() const;
+};
+
+#endif /* defined(__Mosaic_Stitcher__AGFeatureExtractor__) */
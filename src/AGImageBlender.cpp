@@ -5,51 +5,225 @@
 
 #include "AGImageBlender.h"
 
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 using namespace cv;
 using namespace std;
 
+#pragma mark -
+#pragma mark Distance Transform
+
+Rect AGImageBlender::blendingRegionOfImage(const AGImage &image)
+{
+    return Rect(image.boundingBox.tl(), image.image.size());
+}
+
 void AGImageBlender::calculateDistanceTransformOfImage(AGImage &image, AGError &error)
 {
-    if (!image.image.data) {
-        error = { true, "calculateDistanceTransformOfImage: Image has no data." }; return;
+    if (!image.mask.data) {
+        error = { true, "calculateDistanceTransformOfImage: Image has no mask." }; return;
     }
+    // Bounding box is surrounded by black pixels of the mask (or by the plane border), so distance transform
+    // calculated inside it is the same as distance transform calculated on the whole plane
     Mat labels;
-    AGOpenCVHelper::createEmptyMatWithSize(labels, image.image.size(), CV_32FC1);
-    AGOpenCVHelper::createEmptyMatWithSize(image.distanceTransform, image.image.size(), CV_8U);
     distanceTransform(image.mask, image.distanceTransform, labels, CV_DIST_C, CV_DIST_MASK_5);
 }
 
-void AGImageBlender::blendImages(std::vector<AGImage> &images, cv::Mat &outputImage, AGError &error)
+#pragma mark -
+#pragma mark Blending
+
+void AGImageBlender::blendImages(std::vector<AGImage> &images,
+                                 const cv::Size &outputSize,
+                                 cv::Mat &outputImage,
+                                 AGError &error,
+                                 AGRunReport *runReport)
 {
-    AGOpenCVHelper::createEmptyMatWithSize(outputImage, images.front().image.size(), CV_8U);
-    
+    if (images.empty()) {
+        error = { true, "blendImages: There are no images to blend." }; return;
+    }
+    AGOpenCVHelper::createEmptyMatWithSize(outputImage, outputSize, CV_8U);
+
+    Mat numerator, denominator;
+    AGOpenCVHelper::createEmptyMatWithSize(numerator, outputSize, CV_32F);
+    AGOpenCVHelper::createEmptyMatWithSize(denominator, outputSize, CV_32F);
+
+    Rect plane(Point(), outputSize);
     for (auto &image : images) {
+        // Image that was transformed outside the plane has no pixels to blend
+        if (!image.image.data) {
+            continue;
+        }
+        Rect region = blendingRegionOfImage(image);
+        if (image.mask.size() != image.image.size() || (region & plane) != region) {
+            error = { true, "blendImages: Images and masks have to be the same size and inside the plane." }; return;
+        }
         AGError checkError;
-        AGImageBlender::calculateDistanceTransformOfImage(image, checkError);
+        {
+            AGStageTimer timer(runReport, "distanceTransform");
+            AGImageBlender::calculateDistanceTransformOfImage(image, checkError);
+        }
         if (checkError.isError) {
             error = { true, "blendImages: Error while calculating distance transform. " + checkError.description }; return;
         }
+
+        for (int row = 0; row < region.height; ++row) {
+            int planeRow = region.y + row;
+            AGImageBlender::accumulateWeightedRow(image.mask.ptr<uchar>(row),
+                                                  image.distanceTransform.ptr<float>(row),
+                                                  image.image.ptr<uchar>(row),
+                                                  image.image.channels(),
+                                                  numerator.ptr<float>(planeRow) + region.x,
+                                                  denominator.ptr<float>(planeRow) + region.x,
+                                                  region.width);
+        }
+    }
+
+    for (int row = 0; row < outputImage.rows; ++row) {
+        AGImageBlender::normalizeRow(numerator.ptr<float>(row),
+                                     denominator.ptr<float>(row),
+                                     outputImage.ptr<uchar>(row),
+                                     outputImage.cols);
+    }
+}
+
+// Weights are integers (chessboard distance) and pixel values are lower than 256, so all sums stay far below 2^24
+// and are exact in float. This keeps the result identical to the integer arithmetic of per pixel implementation.
+void AGImageBlender::accumulateWeightedRow(const uchar *mask,
+                                           const float *weights,
+                                           const uchar *pixels,
+                                           int channels,
+                                           float *numerator,
+                                           float *denominator,
+                                           int length)
+{
+    int col = 0;
+#if defined(__AVX2__)
+    const __m256i white = _mm256_set1_epi32(WHITE_PIXEL);
+    for (; col <= length - 8; col += 8) {
+        __m256i maskValues = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(mask + col)));
+        __m256 isWhite = _mm256_castsi256_ps(_mm256_cmpeq_epi32(maskValues, white));
+        __m256i pixelValues;
+        if (channels == 1) {
+            pixelValues = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(pixels + col)));
+        }
+        else {
+            const uchar *p = pixels + col * channels;
+            pixelValues = _mm256_setr_epi32(p[0], p[channels], p[2 * channels], p[3 * channels],
+                                            p[4 * channels], p[5 * channels], p[6 * channels], p[7 * channels]);
+        }
+        __m256 weight = _mm256_cvtepi32_ps(_mm256_cvttps_epi32(_mm256_loadu_ps(weights + col)));
+        weight = _mm256_and_ps(weight, isWhite);
+        __m256 weightedPixel = _mm256_mul_ps(weight, _mm256_cvtepi32_ps(pixelValues));
+        _mm256_storeu_ps(numerator + col, _mm256_add_ps(_mm256_loadu_ps(numerator + col), weightedPixel));
+        _mm256_storeu_ps(denominator + col, _mm256_add_ps(_mm256_loadu_ps(denominator + col), weight));
+    }
+#elif defined(__SSE2__)
+    const __m128i white = _mm_set1_epi32(WHITE_PIXEL);
+    const __m128i zero = _mm_setzero_si128();
+    for (; col <= length - 4; col += 4) {
+        int maskBytes;
+        memcpy(&maskBytes, mask + col, sizeof(maskBytes));
+        __m128i maskValues = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(maskBytes), zero), zero);
+        __m128 isWhite = _mm_castsi128_ps(_mm_cmpeq_epi32(maskValues, white));
+        __m128i pixelValues;
+        if (channels == 1) {
+            int pixelBytes;
+            memcpy(&pixelBytes, pixels + col, sizeof(pixelBytes));
+            pixelValues = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(pixelBytes), zero), zero);
+        }
+        else {
+            const uchar *p = pixels + col * channels;
+            pixelValues = _mm_setr_epi32(p[0], p[channels], p[2 * channels], p[3 * channels]);
+        }
+        __m128 weight = _mm_cvtepi32_ps(_mm_cvttps_epi32(_mm_loadu_ps(weights + col)));
+        weight = _mm_and_ps(weight, isWhite);
+        __m128 weightedPixel = _mm_mul_ps(weight, _mm_cvtepi32_ps(pixelValues));
+        _mm_storeu_ps(numerator + col, _mm_add_ps(_mm_loadu_ps(numerator + col), weightedPixel));
+        _mm_storeu_ps(denominator + col, _mm_add_ps(_mm_loadu_ps(denominator + col), weight));
+    }
+#endif
+    for (; col < length; ++col) {
+        if (mask[col] == WHITE_PIXEL) {
+            float weight = (float)(int)weights[col];
+            numerator[col] += weight * pixels[col * channels];
+            denominator[col] += weight;
+        }
+    }
+}
+
+void AGImageBlender::normalizeRow(const float *numerator, const float *denominator, uchar *output, int length)
+{
+    int col = 0;
+#if defined(__SSE2__)
+    const __m128 zero = _mm_setzero_ps();
+    for (; col <= length - 4; col += 4) {
+        __m128 denominatorValues = _mm_loadu_ps(denominator + col);
+        __m128 quotient = _mm_div_ps(_mm_loadu_ps(numerator + col), denominatorValues);
+        quotient = _mm_and_ps(quotient, _mm_cmpneq_ps(denominatorValues, zero));
+        __m128i values = _mm_cvttps_epi32(quotient);
+        values = _mm_packus_epi16(_mm_packs_epi32(values, values), values);
+        int pixelBytes = _mm_cvtsi128_si32(values);
+        memcpy(output + col, &pixelBytes, sizeof(pixelBytes));
+    }
+#endif
+    for (; col < length; ++col) {
+        output[col] = denominator[col] != 0 ? (uchar)(int)(numerator[col] / denominator[col]) : 0;
+    }
+}
+
+#pragma mark -
+#pragma mark Testing
+
+void AGImageBlender::blendImagesPerPixel(std::vector<AGImage> &images,
+                                         const cv::Size &outputSize,
+                                         cv::Mat &outputImage,
+                                         AGError &error)
+{
+    AGOpenCVHelper::createEmptyMatWithSize(outputImage, outputSize, CV_8U);
+
+    // Reference works on whole plane, so every image and mask is placed on its own plane sized copy
+    vector<AGImage> planeImages;
+    vector<Mat> distanceTransforms;
+    for (auto &image : images) {
+        AGImage planeImage = image;
+        planeImage.image = Mat::zeros(outputSize, image.image.data ? image.image.type() : CV_8U);
+        planeImage.mask = Mat::zeros(outputSize, CV_8U);
+        if (image.image.data) {
+            Rect region = blendingRegionOfImage(image);
+            image.image.copyTo(planeImage.image(region));
+            image.mask.copyTo(planeImage.mask(region));
+        }
+        Mat labels, distanceTransform;
+        cv::distanceTransform(planeImage.mask, distanceTransform, labels, CV_DIST_C, CV_DIST_MASK_5);
+        distanceTransforms.push_back(distanceTransform);
+        planeImages.push_back(planeImage);
     }
-    
+
     for (int row = 0; row < outputImage.rows; ++row) {
         for (int col = 0; col < outputImage.cols; ++col) {
             Point currentPoint = Point(col, row);
             int numeratorSum = 0, denominatorSum = 0;
-            for (auto &image : images) {
+            for (int i = 0; i < planeImages.size(); ++i) {
                 AGError checkError;
-                bool isPixelWhite = AGOpenCVHelper::isPixelWhiteInImage(image.mask, currentPoint, checkError);
+                bool isPixelWhite = AGOpenCVHelper::isPixelWhiteInImage(planeImages[i].mask, currentPoint, checkError);
                 if (checkError.isError) {
-                    error = { true, "blendImages: Error while checking white pixel. " + checkError.description }; return;
+                    error = { true, "blendImagesPerPixel: Error while checking white pixel. " + checkError.description }; return;
                 }
                 if (isPixelWhite) {
                     AGError checkErrorDT, checkErrorI;
-                    int weight = AGOpenCVHelper::pixelValueAtPointInImage(image.distanceTransform, currentPoint, checkErrorDT);
+                    int weight = AGOpenCVHelper::pixelValueAtPointInImage(distanceTransforms[i], currentPoint, checkErrorDT);
                     if (checkErrorDT.isError) {
-                        error = { true, "blendImages: Error while getting pixel value of distance transform. " + checkError.description }; return;
+                        error = { true, "blendImagesPerPixel: Error while getting pixel value of distance transform. " + checkErrorDT.description }; return;
                     }
-                    numeratorSum += weight * AGOpenCVHelper::pixelValueAtPointInImage(image.image, currentPoint, checkErrorI);
+                    numeratorSum += weight * AGOpenCVHelper::pixelValueAtPointInImage(planeImages[i].image, currentPoint, checkErrorI);
                     if (checkErrorI.isError) {
-                        error = { true, "blendImages: Error while getting pixel value of image. " + checkErrorI.description }; return;
+                        error = { true, "blendImagesPerPixel: Error while getting pixel value of image. " + checkErrorI.description }; return;
                     }
                     denominatorSum += weight;
                 }
@@ -61,8 +235,35 @@ void AGImageBlender::blendImages(std::vector<AGImage> &images, cv::Mat &outputIm
             AGError checkError;
             AGOpenCVHelper::setPixelValueAtPointInImage(outputImage, currentPoint, pixelValue, checkError);
             if (checkError.isError) {
-                error = { true, "blendImages: Error while setting pixel value. " + checkError.description }; return;
+                error = { true, "blendImagesPerPixel: Error while setting pixel value. " + checkError.description }; return;
             }
         }
     }
 }
+
+void AGImageBlender::testBlendingPerformance(std::vector<AGImage> &images, const cv::Size &outputSize, AGError &error)
+{
+    if (images.empty()) {
+        error = { true, "testBlendingPerformance: There are no images to blend." }; return;
+    }
+    Mat referenceOutput, output;
+
+    int64 start = getTickCount();
+    AGImageBlender::blendImagesPerPixel(images, outputSize, referenceOutput, error);
+    double referenceTime = (getTickCount() - start) / getTickFrequency();
+    if (error.isError) {
+        return;
+    }
+
+    start = getTickCount();
+    AGImageBlender::blendImages(images, outputSize, output, error);
+    double time = (getTickCount() - start) / getTickFrequency();
+    if (error.isError) {
+        return;
+    }
+
+    Mat difference = referenceOutput != output;
+    cout << "Blending per pixel: " << referenceTime << " s" << endl;
+    cout << "Blending row based: " << time << " s (speedup " << referenceTime / time << "x)" << endl;
+    cout << "Different pixels: " << countNonZero(difference) << endl << endl;
+}
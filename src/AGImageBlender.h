@@ -8,6 +8,7 @@
 
 #include "AGOpenCVHelper.h"
 #include "AGDataStructures.h"
+#include "AGRunReport.h"
 
 #include <stdio.h>
 #include <opencv2/opencv.hpp>
@@ -16,28 +17,100 @@
 
 class AGImageBlender {
 public:
-    
+
     /**
-     *  Takes vector of transformed images and blends them into outputImage. Method used for blending is described 
-     *  in master's thesis.
+     *  Takes vector of transformed images and blends them into outputImage. Method used for blending is described
+     *  in master's thesis. Weighted sums are accumulated row by row (vectorized when SSE2/AVX2 is available) and only
+     *  inside bounding box of every image.
      *
-     *  @param images      Vector of transformed images. Images have to be the same size on the same plane.
+     *  @param images      Vector of transformed images. Every image (and mask) covers its bounding box on the plane
+     *                     (or the whole plane when bounding box is not set).
+     *  @param outputSize  Size of the plane.
      *  @param outputImage The result of blending.
      *  @param error       Return error.
+     *  @param runReport   Report to which times of distance transform are added (can be nullptr).
      */
-    static void blendImages(std::vector<AGImage> &images, cv::Mat &outputImage, AGError &error);
-    
+    static void blendImages(std::vector<AGImage> &images,
+                            const cv::Size &outputSize,
+                            cv::Mat &outputImage,
+                            AGError &error,
+                            AGRunReport *runReport = nullptr);
+
+    /**
+     *  Blends images with blendImages(...) and with reference per pixel implementation, compares both results and
+     *  prints execution times (testing purpose).
+     *
+     *  @param images     Vector of transformed images.
+     *  @param outputSize Size of the plane.
+     *  @param error      Return error.
+     */
+    static void testBlendingPerformance(std::vector<AGImage> &images, const cv::Size &outputSize, AGError &error);
+
 private:
-    
+
     /**
-     *  Calculates distance transform of image. Distance transform is assigned to distanceTransform property of
-     *  image object.
+     *  Calculates distance transform of image mask. Distance transform is assigned to distanceTransform property of
+     *  image object (it has the size of the mask, i.e. of bounding box).
      *
      *  @param image Input image.
      *  @param error Return error.
      */
     static void calculateDistanceTransformOfImage(AGImage &image, AGError &error);
-    
+
+    /**
+     *  Returns region of the plane covered by image (image size placed at bounding box corner, or at the origin if
+     *  bounding box is not set).
+     *
+     *  @param image Input image.
+     *
+     *  @return Region of image on the plane.
+     */
+    static cv::Rect blendingRegionOfImage(const AGImage &image);
+
+    /**
+     *  Adds weighted pixel values of one image row to numerator row and weights to denominator row. Only pixels
+     *  that are white in mask are added.
+     *
+     *  @param mask        Mask row.
+     *  @param weights     Distance transform row.
+     *  @param pixels      Image row.
+     *  @param channels    Number of channels of image (only first channel is blended).
+     *  @param numerator   Numerator accumulator row.
+     *  @param denominator Denominator accumulator row.
+     *  @param length      Number of pixels in row.
+     */
+    static void accumulateWeightedRow(const uchar *mask,
+                                      const float *weights,
+                                      const uchar *pixels,
+                                      int channels,
+                                      float *numerator,
+                                      float *denominator,
+                                      int length);
+
+    /**
+     *  Divides numerator row by denominator row and stores result in output row (0 where denominator is 0).
+     *
+     *  @param numerator   Numerator accumulator row.
+     *  @param denominator Denominator accumulator row.
+     *  @param output      Output row.
+     *  @param length      Number of pixels in row.
+     */
+    static void normalizeRow(const float *numerator, const float *denominator, uchar *output, int length);
+
+    /**
+     *  Reference implementation of blending that visits every pixel of every image through AGOpenCVHelper methods
+     *  (testing purpose).
+     *
+     *  @param images      Vector of transformed images.
+     *  @param outputSize  Size of the plane.
+     *  @param outputImage The result of blending.
+     *  @param error       Return error.
+     */
+    static void blendImagesPerPixel(std::vector<AGImage> &images,
+                                    const cv::Size &outputSize,
+                                    cv::Mat &outputImage,
+                                    AGError &error);
+
 };
 
 #endif /* defined(__Mosaic_Stitcher__AGImageBlender__) */
@@ -5,9 +5,11 @@
 
 #include "AGImageLoader.h"
 #include "AGOpenCVHelper.h"
+#include "AGThreadPool.h"
 
 #include <libconfig.h++>
 #include <unistd.h>
+#include <sys/stat.h>
 #include <sstream>
 
 using namespace cv;
@@ -121,6 +123,205 @@ void AGImageLoader::loadConfigurationFile(const char *configFilePath, AGError &e
     catch(const SettingNotFoundException &nfex) {
         error = { true, "loadConfigurationFile: No 'percentOverlap' setting in configuration file." }; return;
     }
+
+    try {
+        this->parameters.ratioTestParameter = configuration.lookup("ratioTestParameter");
+    }
+    catch(const SettingNotFoundException &nfex) {
+        this->parameters.ratioTestParameter = 1.0;
+    }
+
+    try {
+        this->parameters.guidedMatching = configuration.lookup("guidedMatching");
+    }
+    catch(const SettingNotFoundException &nfex) {
+        this->parameters.guidedMatching = false;
+    }
+
+    try {
+        string featureExtractor = configuration.lookup("featureExtractor");
+        this->parameters.featureExtractor = featureExtractor;
+    }
+    catch(const SettingNotFoundException &nfex) {
+        this->parameters.featureExtractor = "sift";
+    }
+    if (this->parameters.featureExtractor != "sift" && this->parameters.featureExtractor != "orb"
+        && this->parameters.featureExtractor != "brisk") {
+        error = { true, "loadConfigurationFile: 'featureExtractor' setting has to be \"sift\", \"orb\" or \"brisk\"." }; return;
+    }
+
+    try {
+        string rigidTransformModel = configuration.lookup("rigidTransformModel");
+        if (rigidTransformModel == "similarity") {
+            this->parameters.rigidTransformModel = SimilarityModel;
+        }
+        else if (rigidTransformModel == "rigid") {
+            this->parameters.rigidTransformModel = RigidModel;
+        }
+        else {
+            error = { true, "loadConfigurationFile: 'rigidTransformModel' setting has to be \"similarity\" or \"rigid\"." }; return;
+        }
+    }
+    catch(const SettingNotFoundException &nfex) {
+        this->parameters.rigidTransformModel = SimilarityModel;
+    }
+
+    try {
+        this->parameters.keypointBudget = configuration.lookup("keypointBudget");
+    }
+    catch(const SettingNotFoundException &nfex) {
+        this->parameters.keypointBudget = 0;
+    }
+
+    try {
+        this->parameters.quantizedDescriptors = configuration.lookup("quantizedDescriptors");
+    }
+    catch(const SettingNotFoundException &nfex) {
+        this->parameters.quantizedDescriptors = false;
+    }
+
+    try {
+        string matchingBackend = configuration.lookup("matchingBackend");
+        if (matchingBackend == "auto") {
+            this->parameters.matchingBackend = AutomaticMatching;
+        }
+        else if (matchingBackend == "bruteForce") {
+            this->parameters.matchingBackend = BruteForceMatching;
+        }
+        else if (matchingBackend == "flann") {
+            this->parameters.matchingBackend = FLANNMatching;
+        }
+        else {
+            error = { true, "loadConfigurationFile: 'matchingBackend' setting has to be \"auto\", \"bruteForce\" or \"flann\"." }; return;
+        }
+    }
+    catch(const SettingNotFoundException &nfex) {
+        this->parameters.matchingBackend = AutomaticMatching;
+    }
+
+    try {
+        this->parameters.flannKeypointsThreshold = configuration.lookup("flannKeypointsThreshold");
+    }
+    catch(const SettingNotFoundException &nfex) {
+        this->parameters.flannKeypointsThreshold = 2000;
+    }
+
+    try {
+        string registrationEngine = configuration.lookup("registrationEngine");
+        this->parameters.registrationEngine = registrationEngine;
+    }
+    catch(const SettingNotFoundException &nfex) {
+        this->parameters.registrationEngine = "features";
+    }
+    if (this->parameters.registrationEngine != "features" && this->parameters.registrationEngine != "phaseCorrelation"
+        && this->parameters.registrationEngine != "pyramid" && this->parameters.registrationEngine != "skeleton") {
+        error = { true, "loadConfigurationFile: 'registrationEngine' setting has to be \"features\", \"phaseCorrelation\", \"pyramid\" or \"skeleton\"." }; return;
+    }
+
+    try {
+        this->parameters.pyramidLevels = configuration.lookup("pyramidLevels");
+    }
+    catch(const SettingNotFoundException &nfex) {
+        this->parameters.pyramidLevels = 2;
+    }
+
+    try {
+        this->parameters.eccRefinement = configuration.lookup("eccRefinement");
+    }
+    catch(const SettingNotFoundException &nfex) {
+        this->parameters.eccRefinement = false;
+    }
+
+    try {
+        this->parameters.registrationConfidence = configuration.lookup("registrationConfidence");
+    }
+    catch(const SettingNotFoundException &nfex) {
+        this->parameters.registrationConfidence = 0.1;
+    }
+
+    this->parameters.registrationTiers.clear();
+    try {
+        const Setting &registrationTiers = configuration.lookup("registrationTiers");
+        for (int i = 0; i < registrationTiers.getLength(); ++i) {
+            string registrationTier = registrationTiers[i];
+            if (registrationTier != "phaseCorrelation" && registrationTier != "pyramid" && registrationTier != "skeleton") {
+                error = { true, "loadConfigurationFile: 'registrationTiers' setting can contain only \"phaseCorrelation\", \"pyramid\" and \"skeleton\"." }; return;
+            }
+            this->parameters.registrationTiers.push_back(registrationTier);
+        }
+    }
+    catch(const SettingNotFoundException &nfex) {
+        this->parameters.registrationTiers.clear();
+    }
+
+    try {
+        this->parameters.consistencyThreshold = configuration.lookup("consistencyThreshold");
+    }
+    catch(const SettingNotFoundException &nfex) {
+        this->parameters.consistencyThreshold = 0.5;
+    }
+
+    try {
+        this->parameters.numberOfThreads = configuration.lookup("numberOfThreads");
+    }
+    catch(const SettingNotFoundException &nfex) {
+        this->parameters.numberOfThreads = 0;
+    }
+
+    try {
+        this->parameters.numberOfIOThreads = configuration.lookup("numberOfIOThreads");
+    }
+    catch(const SettingNotFoundException &nfex) {
+        this->parameters.numberOfIOThreads = 4;
+    }
+
+    try {
+        this->parameters.batchMode = configuration.lookup("batchMode");
+    }
+    catch(const SettingNotFoundException &nfex) {
+        this->parameters.batchMode = false;
+    }
+
+    try {
+        this->parameters.batchQueueCapacity = configuration.lookup("batchQueueCapacity");
+    }
+    catch(const SettingNotFoundException &nfex) {
+        this->parameters.batchQueueCapacity = 2;
+    }
+    // Queue without capacity would block the pipeline forever
+    this->parameters.batchQueueCapacity = max(this->parameters.batchQueueCapacity, 1);
+
+    try {
+        this->parameters.batchMemoryBudget = configuration.lookup("batchMemoryBudget");
+    }
+    catch(const SettingNotFoundException &nfex) {
+        this->parameters.batchMemoryBudget = 4096;
+    }
+
+    try {
+        this->parameters.grayscalePipeline = configuration.lookup("grayscalePipeline");
+    }
+    catch(const SettingNotFoundException &nfex) {
+        this->parameters.grayscalePipeline = false;
+    }
+
+    try {
+        string outputFormat = configuration.lookup("outputFormat");
+        this->parameters.outputFormat = outputFormat;
+    }
+    catch(const SettingNotFoundException &nfex) {
+        this->parameters.outputFormat = "png";
+    }
+    if (this->parameters.outputFormat != "png" && this->parameters.outputFormat != "tiff") {
+        error = { true, "loadConfigurationFile: 'outputFormat' setting has to be \"png\" or \"tiff\"." }; return;
+    }
+
+    try {
+        this->parameters.benchmarkMode = configuration.lookup("benchmarkMode");
+    }
+    catch(const SettingNotFoundException &nfex) {
+        this->parameters.benchmarkMode = false;
+    }
     
 //
 //    try {
@@ -154,7 +355,10 @@ void AGImageLoader::loadConfigurationFile(const char *configFilePath, AGError &e
 //    }
 }
 
-void AGImageLoader::loadTilesInMosaicNumber(std::vector<std::vector<AGImage>> &tiles, int mosaicNumber, AGError &error)
+void AGImageLoader::loadTilesInMosaicNumber(std::vector<std::vector<AGImage>> &tiles,
+                                            int mosaicNumber,
+                                            AGError &error,
+                                            AGRunReport *runReport)
 {
     // This method should always give images in left-right coordinate system
     // Right now images in folder are in left-bottom coordinate system
@@ -163,43 +367,68 @@ void AGImageLoader::loadTilesInMosaicNumber(std::vector<std::vector<AGImage>> &t
     if (mosaicNumber < 0) {
         error = { true, "loadTilesInMosaicNumber: Wrong mosaic number passed." }; return;
     }
-    
-    unsigned long xCoordinatePosition = this->tilesBaseName.find("_X");
-    xCoordinatePosition += 2;
 
-    for (int y = 0; ; ++y) {
-        Mat image = imread(this->tilePathAtPosition(0, y, mosaicNumber), CV_LOAD_IMAGE_GRAYSCALE);
-        if (!image.data) {
-            break;
-        }
-        else {
-            vector<AGImage> nextColumn;
-            tiles.push_back(nextColumn);
+    // Size of the grid is found from file system, without decoding any image
+    int numberOfRows = 0, numberOfColumns = 0;
+    while (this->tileExistsAtPosition(0, numberOfRows, mosaicNumber)) {
+        numberOfRows++;
+    }
+    while (this->tileExistsAtPosition(numberOfColumns, 0, mosaicNumber)) {
+        numberOfColumns++;
+    }
+    if (numberOfRows == 0 || numberOfColumns == 0) {
+        error = { true, "loadTilesInMosaicNumber: There is no images to load. Check path and image name in configuration file." }; return;
+    }
+
+    // Every tile is decoded into its own cell, so tiles can be decoded at the same time
+    vector<vector<Mat>> images(numberOfColumns, vector<Mat>(numberOfRows));
+    AGThreadPool threadPool(this->parameters.numberOfIOThreads);
+    for (int x = 0; x < numberOfColumns; ++x) {
+        for (int y = 0; y < numberOfRows; ++y) {
+            string tilePath = this->tilePathAtPosition(x, y, mosaicNumber);
+            Mat &image = images[x][numberOfRows - y - 1];
+            threadPool.addTask([tilePath, &image, runReport] {
+                Mat decodedImage;
+                {
+                    AGStageTimer timer(runReport, "decode");
+                    decodedImage = imread(tilePath, CV_LOAD_IMAGE_GRAYSCALE);
+                }
+                if (decodedImage.data) {
+                    // Rotation by 180 degrees is exact when done by flipping around both axes
+                    AGStageTimer timer(runReport, "rotate");
+                    flip(decodedImage, image, -1);
+                }
+            });
         }
     }
-    
-    for (int y = (int)tiles.size() - 1; y >= 0; --y) {
-        for (int x = 0; ; ++x) {
-            Mat image = imread(this->tilePathAtPosition(x, y, mosaicNumber), CV_LOAD_IMAGE_GRAYSCALE);
+    threadPool.waitForAllTasks();
+
+    tiles.clear();
+    for (int x = 0; x < numberOfColumns; ++x) {
+        tiles.push_back(vector<AGImage>());
+        for (int y = 0; y < numberOfRows; ++y) {
+            Mat &image = images[x][y];
+            string tileName = this->tileNameAtPosition(x, numberOfRows - y - 1);
             if (!image.data) {
-                break;
-            }
-            else {
-                AGOpenCVHelper::rotateImage(image, 180);
-                AGImage imageInfo(image, x,
-                                  (int)tiles.size() - y - 1,
-                                  image.cols,
-                                  image.rows,
-                                  this->tileNameAtPosition(x, y));
-                tiles[x].push_back(imageInfo);
+                tiles.clear();
+                error = { true, "loadTilesInMosaicNumber: Could not load tile " + tileName + "." }; return;
             }
+            AGImage imageInfo(image, x, y, image.cols, image.rows, tileName);
+            tiles[x].push_back(imageInfo);
         }
     }
-    if (tiles.empty()) {
-        error = { true, "loadTilesInMosaicNumber: There is no images to load. Check path and image name in configuration file." }; return;
+    if (runReport) {
+        runReport->increaseCounter("tiles", numberOfColumns * numberOfRows);
     }
 }
 
+bool AGImageLoader::tileExistsAtPosition(int x, int y, int mosaicNumber)
+{
+    struct stat fileInfo;
+    string tilePath = this->tilePathAtPosition(x, y, mosaicNumber);
+    return !tilePath.empty() && stat(tilePath.c_str(), &fileInfo) == 0 && S_ISREG(fileInfo.st_mode);
+}
+
 string AGImageLoader::tilePathAtPosition(int x, int y, int mosaicNumber)
 {
     if (x < 0 || y < 0) {
@@ -7,6 +7,7 @@
 #define __Mosaic_Stitcher__AGImageLoader__
 
 #include "AGDataStructures.h"
+#include "AGRunReport.h"
 
 #include <stdio.h>
 #include <string>
@@ -29,13 +30,18 @@ public:
     AGImageLoader(const char *configFilePath, AGParameters &parameters, AGError &error);
     
     /**
-     *  Loads images to tiles matrix.
+     *  Loads images to tiles matrix. Size of the grid is taken from file system and tiles are decoded in parallel
+     *  (number of threads is taken from numberOfIOThreads parameter).
      *
      *  @param tiles        Matrix of mosaic tiles to which images will be loaded.
      *  @param mosaicNumber Identifier of currently loaded mosaic.
      *  @param error        Error.
+     *  @param runReport    Report to which decoding times are added (can be nullptr).
      */
-    void loadTilesInMosaicNumber(std::vector<std::vector<AGImage>> &tiles, int mosaicNumber, AGError &error);
+    void loadTilesInMosaicNumber(std::vector<std::vector<AGImage>> &tiles,
+                                 int mosaicNumber,
+                                 AGError &error,
+                                 AGRunReport *runReport = nullptr);
 private:
     
     /**
@@ -57,6 +63,17 @@ private:
      */
     std::string tilePathAtPosition(int x, int y, int mosaicNumber);
     
+    /**
+     *  Checks if tile image file exists (without decoding it).
+     *
+     *  @param x            Coordinate of current tile (x axis).
+     *  @param y            Coordinate of current tile (y axis).
+     *  @param mosaicNumber Identifier of currently loaded mosaic.
+     *
+     *  @return Indicates if tile image file exists.
+     */
+    bool tileExistsAtPosition(int x, int y, int mosaicNumber);
+    
     /**
      *  Return tile image file name.
      *
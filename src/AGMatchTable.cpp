@@ -0,0 +1,113 @@
+//
+//  Created by Aleksander Grzyb on 21/09/15.
+//  Copyright (c) 2015 Aleksander Grzyb. All rights reserved.
+//
+
+#include "AGMatchTable.h"
+
+#include <algorithm>
+
+using namespace cv;
+using namespace std;
+
+#pragma mark -
+#pragma mark Initialization
+
+AGMatchTable::AGMatchTable()
+{
+    this->numberOfMatches = 0;
+}
+
+void AGMatchTable::reserveCapacity(int capacity)
+{
+    if ((int)this->queryIndices.size() >= capacity) {
+        return;
+    }
+    this->queryIndices.resize(capacity);
+    this->trainIndices.resize(capacity);
+    this->distances.resize(capacity);
+    this->pointsOne.resize(capacity);
+    this->pointsTwo.resize(capacity);
+    this->values.resize(capacity);
+    this->selection.resize(capacity);
+    this->order.resize(capacity);
+    this->spareQueryIndices.resize(capacity);
+    this->spareTrainIndices.resize(capacity);
+    this->spareDistances.resize(capacity);
+    this->sparePointsOne.resize(capacity);
+    this->sparePointsTwo.resize(capacity);
+}
+
+void AGMatchTable::assign(const vector<DMatch> &matches,
+                          const vector<KeyPoint> &keypointsOne,
+                          const vector<KeyPoint> &keypointsTwo)
+{
+    this->reserveCapacity((int)matches.size());
+    this->numberOfMatches = (int)matches.size();
+    for (int i = 0; i < this->numberOfMatches; ++i) {
+        this->queryIndices[i] = matches[i].queryIdx;
+        this->trainIndices[i] = matches[i].trainIdx;
+        this->distances[i] = matches[i].distance;
+        this->pointsOne[i] = keypointsOne[matches[i].queryIdx].pt;
+        this->pointsTwo[i] = keypointsTwo[matches[i].trainIdx].pt;
+    }
+}
+
+#pragma mark -
+#pragma mark Filtering
+
+void AGMatchTable::removeRepeatedKeypoints()
+{
+    this->removeRepeatedKeys(this->trainIndices);
+    this->removeRepeatedKeys(this->queryIndices);
+}
+
+void AGMatchTable::removeRepeatedKeys(const vector<int> &keys)
+{
+    int size = this->numberOfMatches;
+    for (int i = 0; i < size; ++i) {
+        this->order[i] = i;
+    }
+    // Index of match is the last criterion, so the order is total and std::sort gives the same result as stable sort
+    // (without its temporary buffer)
+    sort(this->order.begin(), this->order.begin() + size, [&](int first, int second) {
+        if (keys[first] != keys[second]) {
+            return keys[first] < keys[second];
+        }
+        if (this->distances[first] != this->distances[second]) {
+            return this->distances[first] < this->distances[second];
+        }
+        return first < second;
+    });
+
+    int numberOfKeptMatches = 0;
+    for (int i = 0; i < size; ++i) {
+        int index = this->order[i];
+        if (i > 0 && keys[index] == keys[this->order[i - 1]]) {
+            continue;
+        }
+        this->spareQueryIndices[numberOfKeptMatches] = this->queryIndices[index];
+        this->spareTrainIndices[numberOfKeptMatches] = this->trainIndices[index];
+        this->spareDistances[numberOfKeptMatches] = this->distances[index];
+        this->sparePointsOne[numberOfKeptMatches] = this->pointsOne[index];
+        this->sparePointsTwo[numberOfKeptMatches] = this->pointsTwo[index];
+        numberOfKeptMatches++;
+    }
+    this->queryIndices.swap(this->spareQueryIndices);
+    this->trainIndices.swap(this->spareTrainIndices);
+    this->distances.swap(this->spareDistances);
+    this->pointsOne.swap(this->sparePointsOne);
+    this->pointsTwo.swap(this->sparePointsTwo);
+    this->numberOfMatches = numberOfKeptMatches;
+}
+
+#pragma mark -
+#pragma mark Exporting
+
+void AGMatchTable::exportMatches(vector<DMatch> &matches) const
+{
+    matches.resize(this->numberOfMatches);
+    for (int i = 0; i < this->numberOfMatches; ++i) {
+        matches[i] = DMatch(this->queryIndices[i], this->trainIndices[i], this->distances[i]);
+    }
+}
@@ -0,0 +1,153 @@
+//
+//  Created by Aleksander Grzyb on 21/09/15.
+//  Copyright (c) 2015 Aleksander Grzyb. All rights reserved.
+//
+
+#ifndef __Mosaic_Stitcher__AGMatchTable__
+#define __Mosaic_Stitcher__AGMatchTable__
+
+#include <stdio.h>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+ /// Matches between keypoints of two images stored as structure of arrays (indices, distances and coordinates of
+ /// matched keypoints). Filters of AGMosaicStitcher remove matches in place, so one table goes through the whole
+ /// filtering chain. Arrays are never shrunk, so table reused for many pairs stops allocating memory once it has
+ /// seen the largest pair.
+
+class AGMatchTable {
+public:
+    
+    /**
+     *  Constructor of AGMatchTable object.
+     */
+    AGMatchTable();
+    
+    /**
+     *  Fills table with matches and caches coordinates of matched keypoints.
+     *
+     *  @param matches      Input matches.
+     *  @param keypointsOne Keypoints of first image (query).
+     *  @param keypointsTwo Keypoints of second image (train).
+     */
+    void assign(const std::vector<cv::DMatch> &matches,
+                const std::vector<cv::KeyPoint> &keypointsOne,
+                const std::vector<cv::KeyPoint> &keypointsTwo);
+    
+    /**
+     *  Returns number of matches in the table.
+     *
+     *  @return Number of matches.
+     */
+    int size() const { return this->numberOfMatches; }
+    
+    /**
+     *  Removes all matches.
+     */
+    void clear() { this->numberOfMatches = 0; }
+    
+    /**
+     *  Keeps only matches for which shouldKeep(index) returns true (order of kept matches does not change).
+     *  Predicate is called once for every index in increasing order, before match with that index is moved, so
+     *  it can use values that were computed for indices before compaction.
+     *
+     *  @param shouldKeep Predicate that takes index of match.
+     */
+    template <typename Predicate>
+    void keepMatches(Predicate shouldKeep)
+    {
+        int numberOfKeptMatches = 0;
+        for (int i = 0; i < this->numberOfMatches; ++i) {
+            if (!shouldKeep(i)) {
+                continue;
+            }
+            if (numberOfKeptMatches != i) {
+                this->queryIndices[numberOfKeptMatches] = this->queryIndices[i];
+                this->trainIndices[numberOfKeptMatches] = this->trainIndices[i];
+                this->distances[numberOfKeptMatches] = this->distances[i];
+                this->pointsOne[numberOfKeptMatches] = this->pointsOne[i];
+                this->pointsTwo[numberOfKeptMatches] = this->pointsTwo[i];
+            }
+            numberOfKeptMatches++;
+        }
+        this->numberOfMatches = numberOfKeptMatches;
+    }
+    
+    /**
+     *  Leaves at most one match for every keypoint (match with the smallest distance, the first one when distances
+     *  are equal). Repetitions of keypoints from second image are removed first, then repetitions of keypoints
+     *  from first image. Matches are ordered by keypoints from first image afterwards.
+     */
+    void removeRepeatedKeypoints();
+    
+    /**
+     *  Copies matches from the table to vector.
+     *
+     *  @param matches Output matches.
+     */
+    void exportMatches(std::vector<cv::DMatch> &matches) const;
+    
+    /**
+     *  Index of keypoint from first image of every match.
+     */
+    std::vector<int> queryIndices;
+    
+    /**
+     *  Index of keypoint from second image of every match.
+     */
+    std::vector<int> trainIndices;
+    
+    /**
+     *  Distance between descriptors of every match.
+     */
+    std::vector<float> distances;
+    
+    /**
+     *  Coordinates of keypoint from first image of every match.
+     */
+    std::vector<cv::Point2f> pointsOne;
+    
+    /**
+     *  Coordinates of keypoint from second image of every match.
+     */
+    std::vector<cv::Point2f> pointsTwo;
+    
+    /**
+     *  Scratch arrays for values computed by filters for every match (e.g. angles) and for selecting median.
+     */
+    std::vector<double> values;
+    std::vector<double> selection;
+    
+private:
+    
+    /**
+     *  Makes sure that every array can hold given number of matches.
+     *
+     *  @param capacity Number of matches.
+     */
+    void reserveCapacity(int capacity);
+    
+    /**
+     *  Leaves one match (with the smallest distance) for every value of key, matches are ordered by key afterwards.
+     *
+     *  @param keys Array of keys (queryIndices or trainIndices).
+     */
+    void removeRepeatedKeys(const std::vector<int> &keys);
+    
+    /**
+     *  Number of matches in the table (arrays can be longer).
+     */
+    int numberOfMatches;
+    
+    /**
+     *  Scratch arrays used for reordering matches.
+     */
+    std::vector<int> order;
+    std::vector<int> spareQueryIndices;
+    std::vector<int> spareTrainIndices;
+    std::vector<float> spareDistances;
+    std::vector<cv::Point2f> sparePointsOne;
+    std::vector<cv::Point2f> sparePointsTwo;
+};
+
+#endif /* defined(__Mosaic_Stitcher__AGMatchTable__) */
@@ -5,10 +5,17 @@
 
 #include "AGMosaicStitcher.h"
 #include "AGImageBlender.h"
+#include "AGThreadPool.h"
+#include "AGDescriptorMatcher.h"
+#include "AGRobustEstimator.h"
+#include "AGECCRefinement.h"
 
-#include <opencv2/nonfree/features2d.hpp>
 #include <cmath>
 #include <map>
+#include <algorithm>
+#include <mutex>
+#include <sstream>
+#include <functional>
 
 using namespace cv;
 using namespace std;
@@ -17,14 +24,41 @@ using namespace detail;
 #pragma mark -
 #pragma mark Initialization
 
-AGMosaicStitcher::AGMosaicStitcher(const AGParameters &parameters)
+AGMosaicStitcher::AGMosaicStitcher(const AGParameters &parameters,
+                                   AGFeatureCache *featureCache,
+                                   AGRunReport *runReport)
 {
     this->parameters = parameters;
+    this->featureCache = featureCache;
+    this->runReport = runReport;
+    this->isMatchingBenchmarked = false;
     this->pathDetection = new AGPathDetection(parameters);
+    AGError error;
+    this->featureExtractor = AGFeatureExtractor::createFeatureExtractor(parameters.featureExtractor, error);
+    if (error.isError) {
+        cout << "AGMosaicStitcher: " << error.description << " SIFT will be used." << endl;
+        this->featureExtractor = make_shared<AGSIFTFeatureExtractor>();
+    }
+    vector<string> registrationTiers = parameters.registrationTiers;
+    if (registrationTiers.empty() && parameters.registrationEngine != "features") {
+        registrationTiers.push_back(parameters.registrationEngine);
+    }
+    for (const string &registrationTier : registrationTiers) {
+        error = { false, "" };
+        shared_ptr<AGRegistrationEngine> registrationEngine = AGRegistrationEngine::createRegistrationEngine(registrationTier,
+                                                                                                            parameters,
+                                                                                                            error);
+        if (error.isError) {
+            cout << "AGMosaicStitcher: " << error.description << " Tier will be skipped." << endl;
+            continue;
+        }
+        this->registrationEngines.push_back(registrationEngine);
+    }
 }
 
 void AGMosaicStitcher::initTransformsMatrix(int xSize, int ySize)
 {
+    this->transformsMatrix.clear();
     for (int x = 0; x < xSize; x++) {
         vector<Mat> nextColumn;
         this->transformsMatrix.push_back(nextColumn);
@@ -48,32 +82,57 @@ void AGMosaicStitcher::initMaskInImagesMatrix(vector<vector<AGImage>> &imagesMat
 #pragma mark -
 #pragma mark Starting Point
 
-int AGMosaicStitcher::stitchMosaic(vector<vector<AGImage>> &imagesMatrix, Mat &outputImage)
+int AGMosaicStitcher::stitchMosaic(const vector<vector<AGImage>> &tilesMatrix, Mat &outputImage)
 {
-    if (imagesMatrix.empty()) {
+    if (this->registerMosaic(tilesMatrix) == EXIT_FAILURE) {
         return EXIT_FAILURE;
     }
-    for (int x = 0; x < imagesMatrix.size(); x++) {
-        for (int y = 0; y < imagesMatrix[x].size(); y++) {
-            if (!imagesMatrix[x][y].image.data) {
+    return this->composeMosaic(outputImage);
+}
+
+int AGMosaicStitcher::registerMosaic(const vector<vector<AGImage>> &tilesMatrix)
+{
+    if (tilesMatrix.empty()) {
+        return EXIT_FAILURE;
+    }
+    for (int x = 0; x < tilesMatrix.size(); x++) {
+        for (int y = 0; y < tilesMatrix[x].size(); y++) {
+            if (!tilesMatrix[x][y].image.data) {
                 return EXIT_FAILURE;
             }
         }
     }
+    // Working copy shares pixel data with the tiles (Mat headers are reference counted). Stitching only assigns new
+    // matrices to the working copy and never writes into tile pixels, so the same tiles can be stitched many times
+    this->imagesMatrix = tilesMatrix;
     this->testingMode = false;
-    this->initTransformsMatrix((int)imagesMatrix.size(), (int)imagesMatrix.front().size());
-    this->initMaskInImagesMatrix(imagesMatrix);
-    this->pathDetection->detectPaths(imagesMatrix);
+    this->initTransformsMatrix((int)this->imagesMatrix.size(), (int)this->imagesMatrix.front().size());
+    this->initMaskInImagesMatrix(this->imagesMatrix);
+    {
+        AGStageTimer timer(this->runReport, "pathDetection");
+        this->pathDetection->detectPaths(this->imagesMatrix);
+    }
 
-//    this->testPathDetection(imagesMatrix);
+//    this->testPathDetection(this->imagesMatrix);
 
-    this->performStitching(imagesMatrix, outputImage);
-//    this->testStitchBetweenTwoImages(imagesMatrix[1][8], imagesMatrix[1][7], Up);
-//    this->testStitchBetweenTwoImages(imagesMatrix[0][1], imagesMatrix[0][0], Up);
+    this->performRegistration(this->imagesMatrix);
+//    this->testStitchBetweenTwoImages(this->imagesMatrix[1][8], this->imagesMatrix[1][7], Up);
+//    this->testStitchBetweenTwoImages(this->imagesMatrix[0][1], this->imagesMatrix[0][0], Up);
     return EXIT_SUCCESS;
 }
 
-void AGMosaicStitcher::performStitching(vector<vector<AGImage>> &imagesMatrix, Mat &outputImage)
+int AGMosaicStitcher::composeMosaic(Mat &outputImage)
+{
+    if (this->imagesMatrix.empty()) {
+        return EXIT_FAILURE;
+    }
+    this->performComposition(this->imagesMatrix, outputImage);
+    // Working copy is no longer needed, release warped images so they don't wait for the stitcher destruction
+    this->imagesMatrix.clear();
+    return EXIT_SUCCESS;
+}
+
+void AGMosaicStitcher::performRegistration(vector<vector<AGImage>> &imagesMatrix)
 {
     int imageWidth = imagesMatrix.front().front().width;
     int imageHeight = imagesMatrix.front().front().height;
@@ -85,148 +144,63 @@ void AGMosaicStitcher::performStitching(vector<vector<AGImage>> &imagesMatrix, M
     int outputImageWidth = imageWidth * (int)imagesMatrix.size() + 2 * offset;
     int outputImageHeigth = imageHeight * (int)imagesMatrix.front().size() + 2 * offset;
 
-    outputImage = Mat::zeros(outputImageHeigth, outputImageWidth, CV_8UC4);
+    this->mosaicSize = Size(outputImageWidth, outputImageHeigth);
 
     this->xShift = midXCoor * imageWidth + offset;
     this->yShift = midYCoor * imageHeight + offset;
 
-    ImageDirection imageDirection;
+    // Pairs are collected in the same order as they were registered sequentially. Every pair writes only its own
+    // cell of transformsMatrix, so all of them can be registered at the same time
+    vector<AGImagePair> imagePairs;
     if (imagesMatrix.front().size() > imagesMatrix.size()) {
         for (int x = 0; x < midXCoor; x++) {
-            imageDirection = Right;
-            this->applyStitchingAlgorithm(imagesMatrix[x][midYCoor], imagesMatrix[x + 1][midYCoor],
-                                          imageDirection, this->transformsMatrix[x][midYCoor]);
+            this->addImagePair(imagePairs, Point(x, midYCoor), Point(x + 1, midYCoor), Right);
         }
 
         for (int x = midXCoor + 1; x < imagesMatrix.size(); x++) {
-            imageDirection = Left;
-            this->applyStitchingAlgorithm(imagesMatrix[x][midYCoor], imagesMatrix[x - 1][midYCoor],
-                                          imageDirection, this->transformsMatrix[x][midYCoor]);
+            this->addImagePair(imagePairs, Point(x, midYCoor), Point(x - 1, midYCoor), Left);
         }
 
         for (int x = 0; x < imagesMatrix.size(); x++) {
             for (int y = midYCoor - 1; y >= 0; y--) {
-                imageDirection = Down;
-                this->applyStitchingAlgorithm(imagesMatrix[x][y], imagesMatrix[x][y + 1],
-                                              imageDirection, this->transformsMatrix[x][y]);
+                this->addImagePair(imagePairs, Point(x, y), Point(x, y + 1), Down);
             }
             for (int y = midYCoor + 1; y < imagesMatrix.front().size(); y++) {
-                imageDirection = Up;
-                this->applyStitchingAlgorithm(imagesMatrix[x][y], imagesMatrix[x][y - 1],
-                                              imageDirection, this->transformsMatrix[x][y]);
+                this->addImagePair(imagePairs, Point(x, y), Point(x, y - 1), Up);
             }
         }
     } else {
         for (int y = 0; y < midYCoor; y++) {
-            imageDirection = Down;
-            this->applyStitchingAlgorithm(imagesMatrix[midXCoor][y], imagesMatrix[midXCoor][y + 1],
-                                          imageDirection, this->transformsMatrix[midXCoor][y]);
+            this->addImagePair(imagePairs, Point(midXCoor, y), Point(midXCoor, y + 1), Down);
         }
 
         for (int y = midYCoor + 1; y < imagesMatrix.front().size(); y++) {
-            imageDirection = Up;
-            this->applyStitchingAlgorithm(imagesMatrix[midXCoor][y], imagesMatrix[midXCoor][y - 1],
-                                          imageDirection, this->transformsMatrix[midXCoor][y]);
+            this->addImagePair(imagePairs, Point(midXCoor, y), Point(midXCoor, y - 1), Up);
         }
 
         for (int y = 0; y < imagesMatrix.front().size(); y++) {
             for (int x = midXCoor - 1; x >= 0; x--) {
-                imageDirection = Right;
-                this->applyStitchingAlgorithm(imagesMatrix[x][y], imagesMatrix[x + 1][y],
-                                              imageDirection, this->transformsMatrix[x][y]);
+                this->addImagePair(imagePairs, Point(x, y), Point(x + 1, y), Right);
             }
             for (int x = midXCoor + 1; x < imagesMatrix.size(); x++) {
-                imageDirection = Left;
-                this->applyStitchingAlgorithm(imagesMatrix[x][y], imagesMatrix[x - 1][y],
-                                              imageDirection, this->transformsMatrix[x][y]);
+                this->addImagePair(imagePairs, Point(x, y), Point(x - 1, y), Left);
             }
         }
     }
+    this->registerImagePairs(imagesMatrix, imagePairs);
 
-    // All images need to be shifted to the place where reference image is located
-    Mat baseShiftTransform;
-    AGOpenCVHelper::createShiftMatrix(baseShiftTransform, this->xShift, this->yShift);
-    for (int x = 0; x < imagesMatrix.size(); x++) {
-        for (int y = 0; y < imagesMatrix.front().size(); y++) {
-            cvtColor(imagesMatrix[x][y].image, imagesMatrix[x][y].image, CV_GRAY2BGRA);
-            warpAffine(imagesMatrix[x][y].image, imagesMatrix[x][y].image, baseShiftTransform, outputImage.size());
-            warpAffine(imagesMatrix[x][y].mask, imagesMatrix[x][y].mask, baseShiftTransform, outputImage.size());
-        }
-    }
-
-    // Displaying rest of the images
+    // Every image is placed on the final grid with one transformation (base shift followed by the chain of
+    // transformations that leads to the reference image), so it is resampled only once
+    this->composeGlobalTransforms(imagesMatrix);
+}
 
-    for (int x = 0; x < imagesMatrix.size(); x++) {
-        for (int y = 0; y < imagesMatrix.front().size(); y++) {
-            if (x != midXCoor || y != midYCoor) {
-                Mat transformedImage = imagesMatrix[x][y].image;
-                Mat mask = imagesMatrix[x][y].mask;
-                if (imagesMatrix.front().size() > imagesMatrix.size()) {
-                    if (y > midYCoor) {
-                        for (int yTrans = y; yTrans > midYCoor; yTrans--) {
-                            warpAffine(transformedImage, transformedImage, transformsMatrix[x][yTrans],
-                                       outputImage.size());
-                            warpAffine(mask, mask, transformsMatrix[x][yTrans], outputImage.size());
-                        }
-                    } else if (y < midYCoor) {
-                        for (int yTrans = y; yTrans < midYCoor; yTrans++) {
-                            warpAffine(transformedImage, transformedImage, transformsMatrix[x][yTrans],
-                                       outputImage.size());
-                            warpAffine(mask, mask, transformsMatrix[x][yTrans], outputImage.size());
-                        }
-                    }
-
-                    if (x > midXCoor) {
-                        for (int xTrans = x; xTrans > midXCoor; xTrans--) {
-                            warpAffine(transformedImage, transformedImage, transformsMatrix[xTrans][midYCoor],
-                                       outputImage.size());
-                            warpAffine(mask, mask, transformsMatrix[xTrans][midYCoor], outputImage.size());
-                        }
-                    } else if (x < midXCoor) {
-                        for (int xTrans = x; xTrans < midXCoor; xTrans++) {
-                            warpAffine(transformedImage, transformedImage, transformsMatrix[xTrans][midYCoor],
-                                       outputImage.size());
-                            warpAffine(mask, mask, transformsMatrix[xTrans][midYCoor], outputImage.size());
-                        }
-                    }
-                } else {
-                    if (x > midXCoor) {
-                        for (int xTrans = x; xTrans > midXCoor; xTrans--) {
-                            warpAffine(transformedImage, transformedImage, transformsMatrix[xTrans][y],
-                                       outputImage.size());
-                            warpAffine(mask, mask, transformsMatrix[xTrans][y], outputImage.size());
-                        }
-                    } else if (x < midXCoor) {
-                        for (int xTrans = x; xTrans < midXCoor; xTrans++) {
-                            warpAffine(transformedImage, transformedImage, transformsMatrix[xTrans][y],
-                                       outputImage.size());
-                            warpAffine(mask, mask, transformsMatrix[xTrans][y], outputImage.size());
-                        }
-                    }
-
-                    if (y > midYCoor) {
-                        for (int yTrans = y; yTrans > midYCoor; yTrans--) {
-                            warpAffine(transformedImage, transformedImage, transformsMatrix[midXCoor][yTrans],
-                                       outputImage.size());
-                            warpAffine(mask, mask, transformsMatrix[midXCoor][yTrans], outputImage.size());
-                        }
-                    } else if (y < midYCoor) {
-                        for (int yTrans = y; yTrans < midYCoor; yTrans++) {
-                            warpAffine(transformedImage, transformedImage, transformsMatrix[midXCoor][yTrans],
-                                       outputImage.size());
-                            warpAffine(mask, mask, transformsMatrix[midXCoor][yTrans], outputImage.size());
-                        }
-                    }
-                }
-//                transformedImage.copyTo(outputImage, mask);
-//                addWeighted(transformedImage, 1.0, outputImage, 1.0, 0.0, outputImage);
-            }
-        }
+void AGMosaicStitcher::performComposition(vector<vector<AGImage>> &imagesMatrix, Mat &outputImage)
+{
+    {
+        AGStageTimer timer(this->runReport, "warp");
+        this->warpImagesOntoMosaicPlane(imagesMatrix, this->mosaicSize);
     }
-    //  Displaying reference (unchanged) image on the final grid
-//    imagesMatrix[midXCoor][midYCoor].image.copyTo(outputImage, imagesMatrix[midXCoor][midYCoor].mask);
-//    addWeighted(imagesMatrix[midXCoor][midYCoor].image, 1.0, outputImage, 1.0, 0.0, outputImage);
-    
+
     vector<AGImage> imagesToBlend;
     for (auto &imageRow : imagesMatrix) {
         for (auto &image : imageRow) {
@@ -235,17 +209,184 @@ void AGMosaicStitcher::performStitching(vector<vector<AGImage>> &imagesMatrix, M
     }
     
     AGError error;
-    AGImageBlender::blendImages(imagesToBlend, outputImage, error);
+    {
+        AGStageTimer timer(this->runReport, "blend");
+        AGImageBlender::blendImages(imagesToBlend, this->mosaicSize, outputImage, error, this->runReport);
+    }
     if (error.isError) {
         cout << error.description << endl;
     }
+    if (this->parameters.benchmarkMode) {
+        AGError benchmarkError;
+        AGImageBlender::testBlendingPerformance(imagesToBlend, this->mosaicSize, benchmarkError);
+        if (benchmarkError.isError) {
+            cout << benchmarkError.description << endl;
+        }
+    }
+}
+
+#pragma mark -
+#pragma mark Placing Images On Mosaic Plane
+
+void AGMosaicStitcher::composeGlobalTransforms(vector<vector<AGImage>> &imagesMatrix)
+{
+    int midXCoor = floor((imagesMatrix.size() - 1) * 0.5);
+    int midYCoor = floor((imagesMatrix.front().size() - 1) * 0.5);
+
+    Mat baseShiftTransform;
+    AGOpenCVHelper::createShiftMatrix(baseShiftTransform, this->xShift, this->yShift);
+
+    for (int x = 0; x < imagesMatrix.size(); x++) {
+        for (int y = 0; y < imagesMatrix.front().size(); y++) {
+            // Transformations are applied in the same order as they were found: first in the direction
+            // perpendicular to the reference row (or column), then along it
+            vector<Mat> chain;
+            if (imagesMatrix.front().size() > imagesMatrix.size()) {
+                for (int yTrans = y; yTrans > midYCoor; yTrans--) {
+                    chain.push_back(this->transformsMatrix[x][yTrans]);
+                }
+                for (int yTrans = y; yTrans < midYCoor; yTrans++) {
+                    chain.push_back(this->transformsMatrix[x][yTrans]);
+                }
+                for (int xTrans = x; xTrans > midXCoor; xTrans--) {
+                    chain.push_back(this->transformsMatrix[xTrans][midYCoor]);
+                }
+                for (int xTrans = x; xTrans < midXCoor; xTrans++) {
+                    chain.push_back(this->transformsMatrix[xTrans][midYCoor]);
+                }
+            } else {
+                for (int xTrans = x; xTrans > midXCoor; xTrans--) {
+                    chain.push_back(this->transformsMatrix[xTrans][y]);
+                }
+                for (int xTrans = x; xTrans < midXCoor; xTrans++) {
+                    chain.push_back(this->transformsMatrix[xTrans][y]);
+                }
+                for (int yTrans = y; yTrans > midYCoor; yTrans--) {
+                    chain.push_back(this->transformsMatrix[midXCoor][yTrans]);
+                }
+                for (int yTrans = y; yTrans < midYCoor; yTrans++) {
+                    chain.push_back(this->transformsMatrix[midXCoor][yTrans]);
+                }
+            }
+
+            Mat globalTransform;
+            AGOpenCVHelper::convertAffineToHomogeneous(baseShiftTransform, globalTransform);
+            for (auto &transform : chain) {
+                Mat homogeneousTransform;
+                AGOpenCVHelper::convertAffineToHomogeneous(transform, homogeneousTransform);
+                globalTransform = homogeneousTransform * globalTransform;
+            }
+            imagesMatrix[x][y].globalTransform = globalTransform;
+        }
+    }
+}
+
+void AGMosaicStitcher::warpImagesOntoMosaicPlane(vector<vector<AGImage>> &imagesMatrix, const Size &planeSize)
+{
+    for (int x = 0; x < imagesMatrix.size(); x++) {
+        for (int y = 0; y < imagesMatrix.front().size(); y++) {
+            AGImage &image = imagesMatrix[x][y];
+            // Blending uses only the first channel, so in grayscale pipeline tiles are warped as they are
+            Mat colorImage = image.image;
+            if (!this->parameters.grayscalePipeline) {
+                cvtColor(image.image, colorImage, CV_GRAY2BGRA);
+            }
+
+            image.boundingBox = AGOpenCVHelper::boundingBoxOfTransformedImage(colorImage.size(),
+                                                                              image.globalTransform,
+                                                                              planeSize);
+
+            // Warping into bounding box only, so transformation has to be expressed relative to its corner
+            Mat boundingBoxShift, roiTransform;
+            AGOpenCVHelper::createShiftMatrix(boundingBoxShift, -image.boundingBox.x, -image.boundingBox.y);
+            AGOpenCVHelper::convertAffineToHomogeneous(boundingBoxShift, roiTransform);
+            roiTransform = Mat(roiTransform * image.globalTransform).rowRange(0, 2);
+
+            // Warped image keeps only its bounding box, position on the plane is given by the bounding box corner
+            Mat transformedImage, transformedMask;
+            if (image.boundingBox.area() > 0) {
+                warpAffine(colorImage, transformedImage, roiTransform, image.boundingBox.size());
+                warpAffine(image.mask, transformedMask, roiTransform, image.boundingBox.size());
+            }
+            image.image = transformedImage;
+            image.mask = transformedMask;
+        }
+    }
 }
 
-void AGMosaicStitcher::applyStitchingAlgorithm(AGImage &imageOne,
-                                               AGImage &imageTwo,
+#pragma mark -
+#pragma mark Registration Scheduling
+
+void AGMosaicStitcher::addImagePair(vector<AGImagePair> &imagePairs,
+                                    Point imageOneCoordinates,
+                                    Point imageTwoCoordinates,
+                                    ImageDirection imageDirection)
+{
+    AGImagePair imagePair = { imageOneCoordinates, imageTwoCoordinates, imageDirection };
+    imagePairs.push_back(imagePair);
+}
+
+void AGMosaicStitcher::registerImagePairs(vector<vector<AGImage>> &imagesMatrix, vector<AGImagePair> &imagePairs)
+{
+    AGThreadPool threadPool(this->parameters.numberOfThreads);
+    for (auto &imagePair : imagePairs) {
+        threadPool.addTask([this, &imagesMatrix, imagePair] {
+            // Every pair starts with the same random generator state, so RANSAC results don't depend on which
+            // thread (and after which other pairs) the registration is performed
+            theRNG() = RNG((uint64)-1);
+            const Point &one = imagePair.imageOneCoordinates;
+            const Point &two = imagePair.imageTwoCoordinates;
+            this->applyStitchingAlgorithm(imagesMatrix[one.x][one.y],
+                                          imagesMatrix[two.x][two.y],
+                                          imagePair.imageDirection,
+                                          this->transformsMatrix[one.x][one.y]);
+        });
+    }
+    threadPool.waitForAllTasks();
+}
+
+void AGMosaicStitcher::applyStitchingAlgorithm(const AGImage &tileOne,
+                                               const AGImage &tileTwo,
                                                ImageDirection imageDirection,
                                                Mat &transform)
 {
+    // Stages are evaluated lazily in order (cheapest first) until one of them finds transformation, so features are
+    // extracted and matched only when path based transform and every registration tier were rejected
+    vector<function<bool(Mat &)>> registrationStages;
+    if (this->parameters.usePaths) {
+        registrationStages.push_back([&](Mat &stageTransform) {
+            return this->registerImagesWithPaths(tileOne, tileTwo, imageDirection, stageTransform);
+        });
+    }
+    for (const shared_ptr<AGRegistrationEngine> &registrationEngine : this->registrationEngines) {
+        registrationStages.push_back([&, registrationEngine](Mat &stageTransform) {
+            return this->registerImagesWithEngine(*registrationEngine, tileOne, tileTwo, imageDirection, stageTransform);
+        });
+    }
+    registrationStages.push_back([&](Mat &stageTransform) {
+        this->increaseCounter("registration.features");
+        this->registerImagesWithFeatures(tileOne, tileTwo, imageDirection, stageTransform);
+        return true;
+    });
+    for (const function<bool(Mat &)> &registrationStage : registrationStages) {
+        if (registrationStage(transform)) {
+            break;
+        }
+    }
+    if (this->parameters.eccRefinement) {
+        this->refineTransformWithECC(tileOne, tileTwo, imageDirection, transform);
+    }
+}
+
+void AGMosaicStitcher::registerImagesWithFeatures(const AGImage &tileOne,
+                                                  const AGImage &tileTwo,
+                                                  ImageDirection imageDirection,
+                                                  Mat &transform)
+{
+    // Tile takes part in up to four registrations at the same time, so keypoints are stored in local copies
+    // (image data is shared and only read)
+    AGImage imageOne = tileOne;
+    AGImage imageTwo = tileTwo;
     vector<DMatch> filtredMatches;
     if (this->parameters.isAdHoc) {
         Rect firstHalfImageOneROI;
@@ -306,7 +447,7 @@ void AGMosaicStitcher::applyStitchingAlgorithm(AGImage &imageOne,
         firstHalfImageTwo.keypoints = firstHalfImagesFeatures[1].keypoints;
 
         MatchesInfo firstHalfMatchesInfo;
-        this->findMatchesWithBruteForce(firstHalfImagesFeatures, firstHalfMatchesInfo);
+        this->findMatches(firstHalfImageOne, firstHalfImageTwo, firstHalfImagesFeatures, firstHalfMatchesInfo, imageDirection);
 
         this->findFeatures(secondHalfImageOne, secondHalfImageTwo, secondHalfImagesFeatures, imageDirection);
 
@@ -314,7 +455,7 @@ void AGMosaicStitcher::applyStitchingAlgorithm(AGImage &imageOne,
         secondHalfImageTwo.keypoints = secondHalfImagesFeatures[1].keypoints;
 
         MatchesInfo secondHalfMatchesInfo;
-        this->findMatchesWithBruteForce(secondHalfImagesFeatures, secondHalfMatchesInfo);
+        this->findMatches(secondHalfImageOne, secondHalfImageTwo, secondHalfImagesFeatures, secondHalfMatchesInfo, imageDirection);
 
         vector<DMatch> firstHalfFiltredMatches;
         this->filterMatches(firstHalfImageOne, firstHalfImageTwo, firstHalfMatchesInfo.matches, firstHalfFiltredMatches, imageDirection);
@@ -368,7 +509,7 @@ void AGMosaicStitcher::applyStitchingAlgorithm(AGImage &imageOne,
 //        AGOpenCVHelper::saveImage(mat, "image");
 
         vector<KeyPoint> shiftedKeyPoints;
-        for (int i = 0; i <= imageOne.keypoints.size(); i++) {
+        for (int i = 0; i < imageOne.keypoints.size(); i++) {
             KeyPoint shiftedKeyPoint = imageOne.keypoints[i];
             shiftedKeyPoint.pt.x += this->xShift;
             shiftedKeyPoint.pt.y += this->yShift;
@@ -376,7 +517,7 @@ void AGMosaicStitcher::applyStitchingAlgorithm(AGImage &imageOne,
         }
         imageOne.keypoints = shiftedKeyPoints;
 
-        for (int i = 0; i <= imageTwo.keypoints.size(); i++) {
+        for (int i = 0; i < imageTwo.keypoints.size(); i++) {
             KeyPoint shiftedKeyPoint = imageTwo.keypoints[i];
             shiftedKeyPoint.pt.x += this->xShift;
             shiftedKeyPoint.pt.y += this->yShift;
@@ -394,7 +535,7 @@ void AGMosaicStitcher::applyStitchingAlgorithm(AGImage &imageOne,
 
         // Matching features
         MatchesInfo matchesInfo;
-        this->findMatchesWithBruteForce(imagesFeatures, matchesInfo);
+        this->findMatches(imageOne, imageTwo, imagesFeatures, matchesInfo, imageDirection);
 
         // Filtering matches (eliminating outliners)
         this->filterMatches(imageOne, imageTwo, matchesInfo.matches, filtredMatches, imageDirection);
@@ -408,40 +549,141 @@ void AGMosaicStitcher::applyStitchingAlgorithm(AGImage &imageOne,
     this->findTransformBetweenImages(imageOne, imageTwo, filtredMatches, transform, imageDirection);
 }
 
-#pragma mark -
-#pragma mark Matching Features
+bool AGMosaicStitcher::registerImagesWithPaths(const AGImage &imageOne,
+                                               const AGImage &imageTwo,
+                                               ImageDirection imageDirection,
+                                               Mat &transform)
+{
+    bool transformFound;
+    {
+        AGStageTimer timer(this->runReport, "pathTransform");
+        transformFound = this->findTransformBasedOnPaths(imageOne, imageTwo, transform, imageDirection);
+    }
+    if (!transformFound) {
+        this->increaseCounter("registration.paths.rejected");
+        return false;
+    }
+    this->logTransformBetweenImages("Path based transform between images:", imageOne, imageTwo);
+    this->increaseCounter("registration.paths.accepted");
+    this->increaseCounter("transform.path");
+    return true;
+}
 
-void AGMosaicStitcher::findMatchesWithBruteForce(vector<ImageFeatures> &imagesFeatures, MatchesInfo &matchesInfo)
+bool AGMosaicStitcher::registerImagesWithEngine(const AGRegistrationEngine &engine,
+                                                const AGImage &imageOne,
+                                                const AGImage &imageTwo,
+                                                ImageDirection imageDirection,
+                                                Mat &transform)
 {
-    /*
-    * Brute Force Matcher is called twice, because he gives different results that depends on which image
-    * is passed as train, and which as query. Probably this is because he iterates through all keypoints from query
-    * image and makes 1-many relationship to keypoints from train image (we want many-many relationships). As a
-    * solution we combine the result from both calls to bfMatcher and later in algorithm we are removing duplicates.
-    */
+    string engineName = engine.name();
+    Mat engineTransform;
+    double confidence = 0.0;
+    bool isRegistered;
+    {
+        AGStageTimer timer(this->runReport, engine.name());
+        isRegistered = engine.registerImages(imageOne, imageTwo, imageDirection, engineTransform, confidence);
+    }
+    if (!isRegistered || confidence < this->parameters.registrationConfidence) {
+        this->increaseCounter("registration." + engineName + ".rejected");
+        return false;
+    }
+    if (this->parameters.consistencyThreshold > 0.0) {
+        double consistency;
+        {
+            AGStageTimer timer(this->runReport, "consistencyCheck");
+            Rect regionOne = AGOpenCVHelper::overlapRegionOfImage(imageOne.image.size(),
+                                                                  imageDirection,
+                                                                  this->parameters.percentOverlap);
+            consistency = AGRegistrationEngine::consistencyOfTransform(imageOne.image, imageTwo.image, regionOne, engineTransform);
+        }
+        if (consistency < this->parameters.consistencyThreshold) {
+            this->increaseCounter("registration." + engineName + ".inconsistent");
+            return false;
+        }
+    }
+    // Engines work in coordinates of tiles, transforms between images work in coordinates shifted by base shift
+    AGOpenCVHelper::shiftCoordinatesOfTransform(engineTransform, this->xShift, this->yShift, transform);
+
+    this->logTransformBetweenImages("Found transform with " + engineName + " engine. Transforming images:",
+                                    imageOne,
+                                    imageTwo);
+    this->increaseCounter("registration." + engineName + ".accepted");
+    this->increaseCounter("transform." + engineName);
+    return true;
+}
 
-    BFMatcher bfMatcherOne;
-    MatchesInfo matchesInfoOne;
-    bfMatcherOne.match(imagesFeatures[0].descriptors, imagesFeatures[1].descriptors, matchesInfoOne.matches);
+void AGMosaicStitcher::refineTransformWithECC(const AGImage &imageOne,
+                                              const AGImage &imageTwo,
+                                              ImageDirection imageDirection,
+                                              Mat &transform)
+{
+    AGStageTimer timer(this->runReport, "eccRefinement");
+    AGTransformModel model = TranslationModel;
+    if (!this->parameters.simplerTransform && this->parameters.rigidTransform) {
+        model = this->parameters.rigidTransformModel;
+    }
+    Rect regionOne = AGOpenCVHelper::overlapRegionOfImage(imageOne.image.size(), imageDirection, this->parameters.percentOverlap);
+    Mat tileTransform;
+    AGOpenCVHelper::shiftCoordinatesOfTransform(transform, -this->xShift, -this->yShift, tileTransform);
+    double correlation;
+    if (!AGECCRefinement::refineTransform(imageOne.image, imageTwo.image, regionOne, model, tileTransform, correlation)) {
+        this->increaseCounter("ecc.rejected");
+        return;
+    }
+    AGOpenCVHelper::shiftCoordinatesOfTransform(tileTransform, this->xShift, this->yShift, transform);
+    this->increaseCounter("ecc.refined");
+}
 
-    BFMatcher bfMatcherTwo;
-    MatchesInfo matchesInfoTwo;
-    bfMatcherTwo.match(imagesFeatures[1].descriptors, imagesFeatures[0].descriptors, matchesInfoTwo.matches);
+#pragma mark -
+#pragma mark Matching Features
 
-    for (int i = 0; i < matchesInfoOne.matches.size(); i++) {
-        DMatch match;
-        match.queryIdx = matchesInfoOne.matches[i].queryIdx;
-        match.trainIdx = matchesInfoOne.matches[i].trainIdx;
-        match.distance = matchesInfoOne.matches[i].distance;
-        matchesInfo.matches.push_back(match);
+void AGMosaicStitcher::findMatches(AGImage &imageOne,
+                                   AGImage &imageTwo,
+                                   vector<ImageFeatures> &imagesFeatures,
+                                   MatchesInfo &matchesInfo,
+                                   ImageDirection imageDirection)
+{
+    if (!this->parameters.guidedMatching
+        || this->parameters.shiftParameter <= 0.0 || this->parameters.shiftParameter > 1.0) {
+        this->findMatchesWithBruteForce(imagesFeatures, matchesInfo);
+        return;
     }
+    AGStageTimer timer(this->runReport, "guidedMatching");
+    // Both sets of keypoints have the same shift to the mosaic plane, so predicted displacement is the shift prior
+    Mat shiftTransform;
+    this->findShiftTransform(imageOne, imageTwo, shiftTransform, imageDirection);
+    Point2f predictedShift(shiftTransform.at<double>(0, 2), shiftTransform.at<double>(1, 2));
+    Size2f searchRadius(imageOne.width * this->parameters.shiftParameter,
+                        imageOne.height * this->parameters.shiftParameter);
+    AGDescriptorMatcher::matchGuidedMutualNearestNeighbours(imagesFeatures[0].descriptors,
+                                                            imagesFeatures[1].descriptors,
+                                                            imagesFeatures[0].keypoints,
+                                                            imagesFeatures[1].keypoints,
+                                                            predictedShift,
+                                                            searchRadius,
+                                                            this->parameters.ratioTestParameter,
+                                                            matchesInfo.matches,
+                                                            this->featureExtractor->normType());
+}
 
-    for (int i = 0; i < matchesInfoTwo.matches.size(); i++) {
-        DMatch match;
-        match.queryIdx = matchesInfoTwo.matches[i].trainIdx;
-        match.trainIdx = matchesInfoTwo.matches[i].queryIdx;
-        match.distance = matchesInfoTwo.matches[i].distance;
-        matchesInfo.matches.push_back(match);
+void AGMosaicStitcher::findMatchesWithBruteForce(vector<ImageFeatures> &imagesFeatures, MatchesInfo &matchesInfo)
+{
+    AGStageTimer timer(this->runReport, "bruteForceMatching");
+    /*
+    * Previously Brute Force Matcher was called twice (first image as query and then as train) and both results were
+    * combined, so duplicates had to be removed later in algorithm. Now distances are computed once and only matches
+    * between keypoints that are nearest neighbours of each other are kept (every keypoint is matched at most once).
+    */
+    AGDescriptorMatcher::matchDescriptors(imagesFeatures[0].descriptors,
+                                          imagesFeatures[1].descriptors,
+                                          this->parameters,
+                                          matchesInfo.matches,
+                                          this->featureExtractor->normType());
+    // Benchmark runs on the first pair only (FLANN and quantization work only with float descriptors)
+    if (this->parameters.benchmarkMode && this->featureExtractor->normType() == NORM_L2
+        && !this->isMatchingBenchmarked.exchange(true)) {
+        AGDescriptorMatcher::testMatchingPerformance(imagesFeatures[0].descriptors, imagesFeatures[1].descriptors);
+        AGDescriptorMatcher::testMatchingBackends(imagesFeatures[0].descriptors, imagesFeatures[1].descriptors);
     }
 }
 
@@ -459,89 +701,93 @@ void AGMosaicStitcher::filterMatches(AGImage &imageOne,
         return;
     }
     
-    AGError error;
-    Mat outputImage;
+    // Every registration thread keeps its own table, so filtering of next pairs reuses its memory
+    static thread_local AGMatchTable matchTable;
+    matchTable.assign(matches, imageOne.keypoints, imageTwo.keypoints);
+    
     if (this->testingMode) {
-        AGOpenCVHelper::linkTwoImagesTogetherAndDrawMatches(imageOne,
-                                                            imageTwo,
-                                                            matches,
-                                                            outputImage,
-                                                            imageDirection,
-                                                            error);
-        AGOpenCVHelper::saveImage(outputImage, "no_filtering", this->parameters.mosaicsSaveAbsolutePath, error);
+        this->saveMatchesOfTable(imageOne, imageTwo, matchTable, "no_filtering", imageDirection);
     }
     
-    vector<DMatch> matchesWithinRange;
-    this->filterMatchesBasedOnPlacement(imageOne, imageTwo, matches, matchesWithinRange, imageDirection);
+    this->increaseCounter("matches.beforeFiltering", matchTable.size());
+
+    {
+        AGStageTimer timer(this->runReport, "filter.placement");
+        this->filterMatchesBasedOnPlacement(imageOne, imageTwo, matchTable, imageDirection);
+    }
+    this->increaseCounter("matches.afterPlacement", matchTable.size());
 
     if (this->testingMode) {
-        AGOpenCVHelper::linkTwoImagesTogetherAndDrawMatches(imageOne,
-                                                            imageTwo,
-                                                            matchesWithinRange,
-                                                            outputImage,
-                                                            imageDirection,
-                                                            error);
-        AGOpenCVHelper::saveImage(outputImage, "after_on_placement", this->parameters.mosaicsSaveAbsolutePath, error);
+        this->saveMatchesOfTable(imageOne, imageTwo, matchTable, "after_on_placement", imageDirection);
     }
 
-    vector<DMatch> matchesWithNoRepetitions;
-    this->deleteMatchesFromMultipleKeypointsToMultiple(matchesWithinRange, matchesWithNoRepetitions);
+    {
+        AGStageTimer timer(this->runReport, "filter.repetitions");
+        this->deleteMatchesFromMultipleKeypointsToMultiple(matchTable);
+    }
+    this->increaseCounter("matches.afterRepetitions", matchTable.size());
 
     if (this->testingMode) {
-        AGOpenCVHelper::linkTwoImagesTogetherAndDrawMatches(imageOne,
-                                                            imageTwo,
-                                                            matchesWithNoRepetitions,
-                                                            outputImage,
-                                                            imageDirection,
-                                                            error);
-        AGOpenCVHelper::saveImage(outputImage, "after_repetitions", this->parameters.mosaicsSaveAbsolutePath, error);
+        this->saveMatchesOfTable(imageOne, imageTwo, matchTable, "after_repetitions", imageDirection);
     }
 
-    vector<DMatch> matchesAfterRANSAC;
-    this->filterMatchesUsingRANSAC(imageOne, imageTwo, matchesWithNoRepetitions, matchesAfterRANSAC);
+    {
+        AGStageTimer timer(this->runReport, "filter.ransac");
+        this->filterMatchesUsingRANSAC(matchTable);
+    }
+    this->increaseCounter("matches.afterRANSAC", matchTable.size());
 
     if (this->testingMode) {
-        AGOpenCVHelper::linkTwoImagesTogetherAndDrawMatches(imageOne,
-                                                            imageTwo, 
-                                                            matchesAfterRANSAC, 
-                                                            outputImage, 
-                                                            imageDirection, 
-                                                            error);
-        AGOpenCVHelper::saveImage(outputImage, "after_ransac", this->parameters.mosaicsSaveAbsolutePath, error);
+        this->saveMatchesOfTable(imageOne, imageTwo, matchTable, "after_ransac", imageDirection);
     }
 
-    this->filterMatchesBasedOnSlopeAndLength(imageOne, imageTwo, matchesAfterRANSAC, filtredMatches, imageDirection);
+    {
+        AGStageTimer timer(this->runReport, "filter.slopeAndLength");
+        this->filterMatchesBasedOnSlopeAndLength(imageOne, imageTwo, matchTable, imageDirection);
+    }
+    this->increaseCounter("matches.afterSlopeAndLength", matchTable.size());
     
     if (this->testingMode) {
-        AGOpenCVHelper::linkTwoImagesTogetherAndDrawMatches(imageOne, 
-                                                            imageTwo, 
-                                                            filtredMatches, 
-                                                            outputImage, 
-                                                            imageDirection,
-                                                            error);
-        AGOpenCVHelper::saveImage(outputImage,
-                                  "after_slope_and_length", 
-                                  this->parameters.mosaicsSaveAbsolutePath,
-                                  error);
+        this->saveMatchesOfTable(imageOne, imageTwo, matchTable, "after_slope_and_length", imageDirection);
     }
+    
+    matchTable.exportMatches(filtredMatches);
+}
+
+void AGMosaicStitcher::saveMatchesOfTable(AGImage &imageOne,
+                                          AGImage &imageTwo,
+                                          const AGMatchTable &matchTable,
+                                          const string &name,
+                                          ImageDirection imageDirection)
+{
+    AGError error;
+    Mat outputImage;
+    vector<DMatch> matches;
+    matchTable.exportMatches(matches);
+    AGOpenCVHelper::linkTwoImagesTogetherAndDrawMatches(imageOne,
+                                                        imageTwo,
+                                                        matches,
+                                                        outputImage,
+                                                        imageDirection,
+                                                        error);
+    AGOpenCVHelper::saveImage(outputImage, name, this->parameters.mosaicsSaveAbsolutePath, error);
 }
 
 // Calculates angle between matches and x axis, then calculates the median angle of all matches, and deletes that ones that have angle greater than angleParameter
 void AGMosaicStitcher::filterMatchesBasedOnSlopeAndLength(AGImage &imageOne,
                                                           AGImage &imageTwo,
-                                                          vector<DMatch> &matches,
-                                                          vector<DMatch> &filtredMatches,
+                                                          AGMatchTable &matchTable,
                                                           ImageDirection imageDirection)
 {
-    if (matches.empty() || imageOne.keypoints.empty() || imageTwo.keypoints.empty()) {
+    if (matchTable.size() == 0 || imageOne.keypoints.empty() || imageTwo.keypoints.empty()) {
+        matchTable.clear();
         return;
     }
-    vector<double> angles;
-//    vector<double> lengths;
-    vector<pair<int, double>> matchIndexAnglePair;
-    for (int i = 0; i < matches.size(); i++) {
-        Point pointOne = imageOne.keypoints[matches[i].queryIdx].pt;
-        Point pointTwo = imageTwo.keypoints[matches[i].trainIdx].pt;
+    int numberOfMatches = matchTable.size();
+    vector<double> &angles = matchTable.values;
+    for (int i = 0; i < numberOfMatches; i++) {
+        Point pointOne = matchTable.pointsOne[i];
+        Point pointTwo = matchTable.pointsTwo[i];
         if (imageDirection == Up || imageDirection == Down) {
             pointTwo.y += imageOne.height;
         }
@@ -551,91 +797,65 @@ void AGMosaicStitcher::filterMatchesBasedOnSlopeAndLength(AGImage &imageOne,
         pointTwo.y *= -1;
         pointOne.y *= -1;
 
-        vector<double> coeff;
-        AGOpenCVHelper::linearFunctionCoeffsUsingPoints(pointOne, pointTwo, coeff);
-//        lengths.push_back(AGOpenCVHelper::distanceBetweenPoints(pointOne, pointTwo));
-        double angle = atan(coeff[A_COEFF]) * 180 / M_PI;
+        // Slope of line through both points (0 for vertical line, see linearFunctionCoeffsUsingPoints(...))
+        double slope = 0.0;
+        if (pointTwo.x != pointOne.x) {
+            slope = (double)(pointTwo.y - pointOne.y) / (double)(pointTwo.x - pointOne.x);
+        }
+        double angle = atan(slope) * 180 / M_PI;
         if (angle < 0) {
             angle += 180;
         }
         else if (angle == 0) {
             angle = 90;
         }
-        angles.push_back(angle);
+        angles[i] = angle;
     }
 
     if (this->parameters.clustering) {
-        vector<double> lengthsCluster;
         vector<double> anglesCluster;
-//        this->clusterArrayWithinRange(lengths, lengthsCluster, this->parameters.lengthParameter);
-        this->clusterArrayWithinRange(angles, anglesCluster, this->parameters.angleParameter);
-
-        //        cout << "Angle Cluster" << endl;
-        //        for (int i = 0; i < anglesCluster.size(); i++) {
-        //            cout << i << ": " << anglesCluster[i] << endl;
-        //        }
-        //        cout << "-------" << endl;
-        //        cout << "Length Cluster" << endl;
-        //        for (int i = 0; i < lengthsCluster.size(); i++) {
-        //            cout << i << ": " << lengthsCluster[i] << endl;
-        //        }
-        //        cout << "-------" << endl;
+        vector<double> lengthsCluster;
+        vector<double> anglesArray(angles.begin(), angles.begin() + numberOfMatches);
+        this->clusterArrayWithinRange(anglesArray, anglesCluster, this->parameters.angleParameter);
 
-        for (int i = 0; i < matches.size(); i++) {
+        matchTable.keepMatches([&](int i) {
             for (int a = 0; a < anglesCluster.size(); a++) {
-                if (angles[i] == anglesCluster[a]) {
-                    for (int b = 0; b < lengthsCluster.size(); b++) {
-//                        if (lengths[i] == lengthsCluster[b]) {
-                            //                            cout << "Angle " << angles[i] << " Length " << lengths[i] << endl;
-                        filtredMatches.push_back(matches[i]);
-//                        }
-                    }
+                if (angles[i] == anglesCluster[a] && !lengthsCluster.empty()) {
+                    return true;
                 }
             }
-        }
+            return false;
+        });
     }
     else {
-        vector<double> anglesCopy = angles;
-        sort(anglesCopy.begin(), anglesCopy.end());
-        double medianAngle = anglesCopy[floor(angles.size() * 0.5)];
-
-//        vector<double> lengthCopy = lengths;
-//        sort(lengthCopy.begin(), lengthCopy.end());
-//        double medianLength = lengthCopy[floor(lengths.size() * 0.5)];
-
-        //        cout << "Median both" << endl;
-        for (int i = 0; i < matches.size(); i++) {
-            if (angles[i] > medianAngle - this->parameters.angleParameter
-                && angles[i] < medianAngle + this->parameters.angleParameter) {
-//                if (lengths[i] > medianLength - this->parameters.lengthParameter && lengths[i] < medianLength + this->parameters.lengthParameter) {
-                    //                    cout << "Angle " << angles[i] << " Length " << lengths[i] << endl;
-                    filtredMatches.push_back(matches[i]);
-//                }
-            }
-        }
-        //        cout << "Median angle: " << medianAngle << endl;
-        //        cout << "Median length: " << medianLength << endl;
+        // Median is selected (not sorted) from the copy of angles
+        vector<double> &anglesCopy = matchTable.selection;
+        copy(angles.begin(), angles.begin() + numberOfMatches, anglesCopy.begin());
+        int medianIndex = floor(numberOfMatches * 0.5);
+        nth_element(anglesCopy.begin(), anglesCopy.begin() + medianIndex, anglesCopy.begin() + numberOfMatches);
+        double medianAngle = anglesCopy[medianIndex];
+
+        matchTable.keepMatches([&](int i) {
+            return angles[i] > medianAngle - this->parameters.angleParameter
+                   && angles[i] < medianAngle + this->parameters.angleParameter;
+        });
     }
-
-    //    for (int i = 0; i < lengths.size(); i++) {
-    //        cout << i << ": " << lengths[i] << ";" << angles[i] << endl;
-    //    }
 }
 
 // Filtering matches based on coordinates x or y. The main idea is that images cannot be shifted too far from each other. You can control the allowed shift by error paramter (expressed in percentage)
 void AGMosaicStitcher::filterMatchesBasedOnPlacement(AGImage &imageOne,
                                                      AGImage &imageTwo,
-                                                     vector<DMatch> &matches,
-                                                     vector<DMatch> &filtredMatches,
+                                                     AGMatchTable &matchTable,
                                                      ImageDirection imageDirection)
 {
-    if (matches.empty() || !imageOne.image.data || !imageTwo.image.data
+    if (matchTable.size() == 0 || !imageOne.image.data || !imageTwo.image.data
         || this->parameters.shiftParameter > 1.0 || this->parameters.shiftParameter < 0.0) {
+        matchTable.clear();
         return;
     }
-    for (int i = 0; i < matches.size(); i++) {
-        Point pointOne = imageOne.keypoints[matches[i].queryIdx].pt;
-        Point pointTwo = imageTwo.keypoints[matches[i].trainIdx].pt;
+    matchTable.keepMatches([&](int i) {
+        Point pointOne = matchTable.pointsOne[i];
+        Point pointTwo = matchTable.pointsTwo[i];
         bool inRange = false;
         if (imageDirection == Up || imageDirection == Down) {
             if (abs(pointOne.x - pointTwo.x) < imageOne.width * this->parameters.shiftParameter) {
@@ -647,126 +867,79 @@ void AGMosaicStitcher::filterMatchesBasedOnPlacement(AGImage &imageOne,
                 inRange = true;
             }
         }
-        if (inRange) {
-            double distance = 0.0;
-            switch (imageDirection) {
-                case Up:
-                    distance = sqrt(pow(abs(pointTwo.x - pointOne.x), 2.0) +
-                                    pow(abs((pointOne.y + imageTwo.height) -pointTwo.y), 2.0));
-                    break;
-
-                case Down:
-                    distance = sqrt(pow(abs(pointTwo.x - pointOne.x), 2.0) +
-                                    pow(abs((pointTwo.y + imageOne.height) - pointOne.y), 2.0));
-                    break;
-
-                case Left:
-                    distance = sqrt(pow(abs((pointOne.x + imageTwo.width) - pointTwo.x), 2.0) +
-                                    pow(abs(pointTwo.y - pointOne.y), 2.0));
-                    break;
-
-                case Right:
-                    distance = sqrt(pow(abs((pointTwo.x + imageOne.width) - pointOne.x), 2.0) +
-                                    pow(abs(pointTwo.y - pointOne.y), 2.0));
-                    break;
-            }
-            if (distance < imageOne.height * this->parameters.percentOverlap * 2.5) {
-                filtredMatches.push_back(matches[i]);
-            }
+        if (!inRange) {
+            return false;
         }
-    }
-}
+        double distance = 0.0;
+        switch (imageDirection) {
+            case Up:
+                distance = sqrt(pow(abs(pointTwo.x - pointOne.x), 2.0) +
+                                pow(abs((pointOne.y + imageTwo.height) -pointTwo.y), 2.0));
+                break;
 
-// Finding features that were matched to more than one feature and chosing the one with the minimum distance
-void AGMosaicStitcher::deleteMatchesFromMultipleKeypointsToMultiple(vector<DMatch> &matches,
-                                                                    vector<DMatch> &filtredMatches)
-{
-    if (matches.empty()) {
-        return;
-    }
+            case Down:
+                distance = sqrt(pow(abs(pointTwo.x - pointOne.x), 2.0) +
+                                pow(abs((pointTwo.y + imageOne.height) - pointOne.y), 2.0));
+                break;
 
-    // Firstly we need to delete multiple matches from keypoints from first image and then we
-    // need to delete multiple matches from keypoints from second image.
-    vector<DMatch> matchesAfterFirstDeletion;
+            case Left:
+                distance = sqrt(pow(abs((pointOne.x + imageTwo.width) - pointTwo.x), 2.0) +
+                                pow(abs(pointTwo.y - pointOne.y), 2.0));
+                break;
 
-    // First deletion
-    map<int, vector<DMatch>> repetitions;
-    for (int i = 0; i < matches.size(); i++) {
-        repetitions[matches[i].trainIdx].push_back(matches[i]);
-    }
-    map<int, vector<DMatch>>::iterator it = repetitions.begin();
-    for (it = repetitions.begin(); it != repetitions.end(); ++it) {
-        if (it->second.size() > 1) {
-            float minDistance = 1000;
-            int minIndex = 0;
-            for (int i = 0; i < it->second.size(); i++) {
-                if (minDistance < it->second[i].distance) {
-                    minDistance = it->second[i].distance;
-                    minIndex = i;
-                }
-            }
-            matchesAfterFirstDeletion.push_back(it->second[minIndex]);
-        }
-        else {
-            matchesAfterFirstDeletion.push_back(it->second.front());
+            case Right:
+                distance = sqrt(pow(abs((pointTwo.x + imageOne.width) - pointOne.x), 2.0) +
+                                pow(abs(pointTwo.y - pointOne.y), 2.0));
+                break;
         }
-    }
+        return distance < imageOne.height * this->parameters.percentOverlap * 2.5;
+    });
+}
 
-    // Second deletion
-    repetitions.clear();
-    for (int i = 0; i < matchesAfterFirstDeletion.size(); i++) {
-        repetitions[matchesAfterFirstDeletion[i].queryIdx].push_back(matchesAfterFirstDeletion[i]);
-    }
-    it = repetitions.begin();
-    for (it = repetitions.begin(); it != repetitions.end(); ++it) {
-        if (it->second.size() > 1) {
-            float minDistance = 1000;
-            int minIndex = 0;
-            for (int i = 0; i < it->second.size(); i++) {
-                if (minDistance < it->second[i].distance) {
-                    minDistance = it->second[i].distance;
-                    minIndex = i;
-                }
-            }
-            filtredMatches.push_back(it->second[minIndex]);
-        }
-        else {
-            filtredMatches.push_back(it->second.front());
-        }
+// Finding features that were matched to more than one feature and chosing the one with the minimum distance
+void AGMosaicStitcher::deleteMatchesFromMultipleKeypointsToMultiple(AGMatchTable &matchTable)
+{
+    if (matchTable.size() == 0) {
+        return;
     }
+    // Matches are sorted by keypoints (instead of grouped in maps), repetitions are next to each other then
+    matchTable.removeRepeatedKeypoints();
 }
 
-void AGMosaicStitcher::filterMatchesUsingRANSAC(AGImage &imageOne,
-                                                AGImage &imageTwo,
-                                                vector<DMatch> &matches,
-                                                vector<DMatch> &filtredMatches)
+void AGMosaicStitcher::filterMatchesUsingRANSAC(AGMatchTable &matchTable)
 {
-    if (matches.empty()) {
-//        cerr << "Couldn't perform RANSAC. Matches vector is empty." << endl;
+    AGTransformModel model = this->transformModel();
+    if (matchTable.size() <= AGRobustEstimator::minimalSampleSize(model)) {
         return;
     }
-    vector<Point2f> imageOneKeypoints;
-    vector<Point2f> imageTwoKeypoints;
-    for (int i = 0; i < matches.size(); i++) {
-        Point2f pointOne = imageOne.keypoints[matches[i].queryIdx].pt;
-        imageOneKeypoints.push_back(pointOne);
-        Point2f pointTwo = imageTwo.keypoints[matches[i].trainIdx].pt;
-        imageTwoKeypoints.push_back(pointTwo);
-    }
-    Mat mask;
-    if (imageTwoKeypoints.size() >= 4 && imageOneKeypoints.size() >= 4) {
-        Mat homography = findHomography(imageTwoKeypoints, imageOneKeypoints, CV_RANSAC, 3, mask);
-        for (int i = 0; i < matches.size(); i++) {
-            if((unsigned int)mask.at<uchar>(i)) {
-                filtredMatches.push_back(matches[i]);
-            }
-        }
+    // The same model as the final transform is estimated (instead of homography), matches are drawn in order of
+    // descriptor distances and sampling stops when confidence is reached
+    static thread_local vector<uchar> inliers;
+    Mat transform;
+    int numberOfIterations = 0;
+    bool isEstimated = AGRobustEstimator::estimateTransform(matchTable.pointsOne.data(),
+                                                            matchTable.pointsTwo.data(),
+                                                            matchTable.distances.data(),
+                                                            matchTable.size(),
+                                                            model,
+                                                            transform,
+                                                            inliers,
+                                                            numberOfIterations);
+    this->increaseCounter("estimator.iterations", numberOfIterations);
+    if (!isEstimated) {
+        return;
     }
-    else {
-        for (int i = 0; i < matches.size(); i++) {
-            filtredMatches.push_back(matches[i]);
-        }
+    matchTable.keepMatches([&](int i) {
+        return inliers[i] != 0;
+    });
+}
+
+AGTransformModel AGMosaicStitcher::transformModel()
+{
+    if (this->parameters.simplerTransform) {
+        return TranslationModel;
     }
+    return this->parameters.rigidTransformModel;
 }
 
 #pragma mark -
@@ -777,52 +950,21 @@ void AGMosaicStitcher::findFeatures(AGImage &imageOne,
                                     vector<ImageFeatures> &imagesFeatures,
                                     ImageDirection imageDirection)
 {
-    Rect roiImageOne, roiImageTwo;
     ImageFeatures imageOneFeatures, imageTwoFeatures;
     imagesFeatures.clear();
 
-    switch (imageDirection) {
-        case Up:
-            roiImageOne = Rect(0, 0, imageOne.width, (double)imageOne.height * this->parameters.percentOverlap);
-            roiImageTwo = Rect(0, (double)imageTwo.height * (1.0 - this->parameters.percentOverlap),
-                               imageTwo.width, (double)imageTwo.height * this->parameters.percentOverlap);
-            break;
-
-        case Down:
-            roiImageOne = Rect(0, (double)imageOne.height * (1.0 - this->parameters.percentOverlap),
-                               imageOne.width, imageOne.height * this->parameters.percentOverlap);
-            roiImageTwo = Rect(0, 0, imageTwo.width, (double)imageTwo.height * this->parameters.percentOverlap);
-            break;
-
-        case Left:
-            roiImageOne = Rect(0, 0, (double)imageTwo.width * this->parameters.percentOverlap, imageTwo.height);
-            roiImageTwo = Rect((double)imageTwo.width * (1.0 - this->parameters.percentOverlap),
-                               0, (double)imageTwo.width * this->parameters.percentOverlap, imageTwo.height);
-            break;
-
-        case Right:
-            roiImageOne = Rect((double)imageTwo.width * (1.0 - this->parameters.percentOverlap),
-                               0, (double)imageOne.width * this->parameters.percentOverlap, imageOne.height);
-            roiImageTwo = Rect(0, 0, (double)imageTwo.width * this->parameters.percentOverlap, imageTwo.height);
-            break;
-    }
-
-    this->findFeaturesWithSIFT(imageOne, imageOneFeatures, roiImageOne);
-    this->findFeaturesWithSIFT(imageTwo, imageTwoFeatures, roiImageTwo);
+    this->findFeaturesInOverlapOfImage(imageOne, imageDirection, imageOneFeatures);
+    this->findFeaturesInOverlapOfImage(imageTwo, AGOpenCVHelper::oppositeDirection(imageDirection), imageTwoFeatures);
 
     if (!this->parameters.isAdHoc) {
-        for (int i = 0; i <= imageOneFeatures.keypoints.size(); i++) {
-            KeyPoint keyPoint = imageOneFeatures.keypoints[i];
-            keyPoint.pt.x = keyPoint.pt.x + this->xShift;
-            keyPoint.pt.y = keyPoint.pt.y + this->yShift;
-            imageOneFeatures.keypoints[i] = keyPoint;
+        for (int i = 0; i < imageOneFeatures.keypoints.size(); i++) {
+            imageOneFeatures.keypoints[i].pt.x += this->xShift;
+            imageOneFeatures.keypoints[i].pt.y += this->yShift;
         }
 
-        for (int i = 0; i <= imageTwoFeatures.keypoints.size(); i++) {
-            KeyPoint keyPoint = imageTwoFeatures.keypoints[i];
-            keyPoint.pt.x = keyPoint.pt.x + this->xShift;
-            keyPoint.pt.y = keyPoint.pt.y + this->yShift;
-            imageTwoFeatures.keypoints[i] = keyPoint;
+        for (int i = 0; i < imageTwoFeatures.keypoints.size(); i++) {
+            imageTwoFeatures.keypoints[i].pt.x += this->xShift;
+            imageTwoFeatures.keypoints[i].pt.y += this->yShift;
         }
     }
 
@@ -830,14 +972,73 @@ void AGMosaicStitcher::findFeatures(AGImage &imageOne,
     imagesFeatures.push_back(imageTwoFeatures);
 }
 
-void AGMosaicStitcher::findFeaturesWithSIFT(AGImage &inputImage, ImageFeatures &imageFeatures, Rect &roi)
+void AGMosaicStitcher::findFeaturesInOverlapOfImage(AGImage &inputImage, ImageDirection side, ImageFeatures &imageFeatures)
 {
-    SIFT featuresFinder = SIFT::SIFT(0, 3, 0.02, 10, 1.5);
-//    SiftFeatureDetector featuresFinder = SiftFeatureDetector(0, 3, 0.04, 10, 1.5);
-    Mat mask = Mat::zeros(inputImage.image.size(), CV_8UC1);
-    Mat roin(mask, roi);
+    Rect roi = AGOpenCVHelper::overlapRegionOfImage(inputImage.image.size(), side, this->parameters.percentOverlap);
+    if (!this->featureCache) {
+        this->findFeaturesWithExtractor(inputImage, imageFeatures, roi);
+        return;
+    }
+
+    AGFeatureKey key;
+    key.tileName = inputImage.name;
+    key.tileSize = inputImage.image.size();
+    key.side = side;
+    key.percentOverlap = this->parameters.percentOverlap;
+    key.detector = this->detectorDescription();
+    // Cached keypoints are in tile coordinates, shift to the mosaic plane is applied to the copy by the caller
+    this->featureCache->featuresForKey(key, [&](ImageFeatures &features) {
+        this->findFeaturesWithExtractor(inputImage, features, roi);
+    }, imageFeatures);
+}
+
+void AGMosaicStitcher::findFeaturesWithExtractor(AGImage &inputImage, ImageFeatures &imageFeatures, Rect &roi)
+{
+    AGStageTimer timer(this->runReport, "featureExtraction");
+    // Detector runs only on the region with margin (pyramid of whole tile is not built), mask keeps keypoints
+    // inside the region itself
+    Rect stripRegion = Rect(roi.x - FEATURES_STRIP_MARGIN,
+                            roi.y - FEATURES_STRIP_MARGIN,
+                            roi.width + 2 * FEATURES_STRIP_MARGIN,
+                            roi.height + 2 * FEATURES_STRIP_MARGIN) & Rect(Point(), inputImage.image.size());
+    Mat strip;
+    inputImage.image(stripRegion).copyTo(strip);
+    Rect regionInStrip(roi.tl() - stripRegion.tl(), roi.size());
+    Mat mask = Mat::zeros(strip.size(), CV_8UC1);
+    Mat roin(mask, regionInStrip);
     roin = Scalar(255, 255, 255);
-    featuresFinder(inputImage.image, mask, imageFeatures.keypoints, imageFeatures.descriptors);
+    this->featureExtractor->detectAndCompute(strip, mask, imageFeatures.keypoints, imageFeatures.descriptors);
+    // Keypoint budget bounds cost of matching and transform estimation of every pair
+    long numberOfDetectedKeypoints = imageFeatures.keypoints.size();
+    AGFeatureExtractor::selectKeypointsInGrid(imageFeatures.keypoints,
+                                              imageFeatures.descriptors,
+                                              regionInStrip,
+                                              this->parameters.keypointBudget);
+    this->increaseCounter("features.discarded", numberOfDetectedKeypoints - imageFeatures.keypoints.size());
+    for (auto &keyPoint : imageFeatures.keypoints) {
+        keyPoint.pt.x += stripRegion.x;
+        keyPoint.pt.y += stripRegion.y;
+    }
+    if (this->parameters.quantizedDescriptors && this->featureExtractor->normType() == NORM_L2) {
+        Mat quantizedDescriptors;
+        AGDescriptorMatcher::quantizeDescriptors(imageFeatures.descriptors, quantizedDescriptors);
+        imageFeatures.descriptors = quantizedDescriptors;
+    }
+    this->increaseCounter("features.strips");
+    this->increaseCounter("features.keypoints", imageFeatures.keypoints.size());
+}
+
+string AGMosaicStitcher::detectorDescription()
+{
+    stringstream description;
+    description << this->featureExtractor->description() << "+margin" << FEATURES_STRIP_MARGIN;
+    if (this->parameters.quantizedDescriptors && this->featureExtractor->normType() == NORM_L2) {
+        description << "+uint8";
+    }
+    if (this->parameters.keypointBudget > 0) {
+        description << "+budget" << this->parameters.keypointBudget;
+    }
+    return description.str();
 }
 
 #pragma mark -
@@ -849,6 +1050,7 @@ void AGMosaicStitcher::findTransformBetweenImages(AGImage &imageOne,
                                                   Mat &transform,
                                                   ImageDirection imageDirection)
 {
+    AGStageTimer timer(this->runReport, "transformEstimation");
     vector<Point2f> imageOneSelectedKeypoints;
     vector<Point2f> imageTwoSelectedKeypoints;
     for (int i = 0; i < matches.size(); i++) {
@@ -859,21 +1061,10 @@ void AGMosaicStitcher::findTransformBetweenImages(AGImage &imageOne,
         imageTwoSelectedKeypoints.push_back(pointTwo);
     }
 
-    // finding transform between images based on detected blood vessels paths
-    if (this->parameters.usePaths && this->findTransformBasedOnPaths(imageOne, imageTwo, transform, imageDirection)) {
-        AGError error;
-        cout << "Path based transform between images: " << endl;
-        cout << "1. " << AGOpenCVHelper::getDescriptionOfImage(imageOne, error) << endl;
-        cout << "2. " << AGOpenCVHelper::getDescriptionOfImage(imageTwo, error) << endl << endl;
-        return;
-    }
-
     // simply shifting image when there is no keypoints detected
     if ((imageOneSelectedKeypoints.empty() || imageTwoSelectedKeypoints.empty())) {
-        AGError error;
-        cout << "Lack of keypoints in one of the images. Shifting images:" << endl;
-        cout << "1. " << AGOpenCVHelper::getDescriptionOfImage(imageOne, error) << endl;
-        cout << "2. " << AGOpenCVHelper::getDescriptionOfImage(imageTwo, error) << endl << endl;
+        this->logTransformBetweenImages("Lack of keypoints in one of the images. Shifting images:", imageOne, imageTwo);
+        this->increaseCounter("transform.shift.noKeypoints");
         this->findShiftTransform(imageOne, imageTwo, transform, imageDirection);
         return;
     }
@@ -891,33 +1082,42 @@ void AGMosaicStitcher::findTransformBetweenImages(AGImage &imageOne,
         meanXDiff = sumXDiff / matches.size();
         meanYDiff = sumYDiff / matches.size();
         AGOpenCVHelper::createShiftMatrix(transform, meanXDiff, meanYDiff);
-        AGError error;
-        cout << "Found simpler transform. Transforming images: " << endl;
-        cout << "1. " << AGOpenCVHelper::getDescriptionOfImage(imageOne, error) << endl;
-        cout << "2. " << AGOpenCVHelper::getDescriptionOfImage(imageTwo, error) << endl << endl;
+        this->logTransformBetweenImages("Found simpler transform. Transforming images:", imageOne, imageTwo);
+        this->increaseCounter("transform.simpler");
         return;
     }
     else if (this->parameters.rigidTransform) {
-        transform = estimateRigidTransform(imageOneSelectedKeypoints, imageTwoSelectedKeypoints, false);
+        // Outliers were already rejected by robust estimator (filterMatchesUsingRANSAC(...)), so model is only
+        // fitted to remaining matches
+        if (!AGRobustEstimator::fitTransform(imageOneSelectedKeypoints.data(),
+                                             imageTwoSelectedKeypoints.data(),
+                                             (int)imageOneSelectedKeypoints.size(),
+                                             this->parameters.rigidTransformModel,
+                                             transform)) {
+            transform = Mat();
+        }
     }
 
     if (transform.cols != 3 || transform.rows != 2) {
-        AGError error;
-        cout << "Found transform is invalid. Shifting images:" << endl;
-        cout << "1. " << AGOpenCVHelper::getDescriptionOfImage(imageOne, error) << endl;
-        cout << "2. " << AGOpenCVHelper::getDescriptionOfImage(imageTwo, error) << endl << endl;
+        this->logTransformBetweenImages("Found transform is invalid. Shifting images:", imageOne, imageTwo);
+        this->increaseCounter("transform.shift.invalidTransform");
         this->findShiftTransform(imageOne, imageTwo, transform, imageDirection);
         return;
     }
 
-    AGError error;
-    cout << "Found rigid transform. Transforming images:" << endl;
-    cout << "1. " << AGOpenCVHelper::getDescriptionOfImage(imageOne, error) << endl;
-    cout << "2. " << AGOpenCVHelper::getDescriptionOfImage(imageTwo, error) << endl << endl;
+    this->logTransformBetweenImages("Found rigid transform. Transforming images:", imageOne, imageTwo);
+    this->increaseCounter("transform.rigid");
 }
 
-bool AGMosaicStitcher::findTransformBasedOnPaths(AGImage &imageOne,
-                                                 AGImage &imageTwo,
+void AGMosaicStitcher::increaseCounter(const string &counter, long value)
+{
+    if (this->runReport) {
+        this->runReport->increaseCounter(counter, value);
+    }
+}
+
+bool AGMosaicStitcher::findTransformBasedOnPaths(const AGImage &imageOne,
+                                                 const AGImage &imageTwo,
                                                  Mat &transform,
                                                  ImageDirection imageDirection)
 {
@@ -980,7 +1180,7 @@ bool AGMosaicStitcher::findTransformBasedOnPaths(AGImage &imageOne,
     return transformFound;
 }
 
-bool AGMosaicStitcher::selectPointFromPath(AGImage &image, ImageDirection desiredPlace, Point &point)
+bool AGMosaicStitcher::selectPointFromPath(const AGImage &image, ImageDirection desiredPlace, Point &point)
 {
     bool pointSelected = false;
     point.x = image.width;
@@ -1043,6 +1243,19 @@ void AGMosaicStitcher::findShiftTransform(AGImage &imageOne,
 #pragma mark -
 #pragma mark Helper Methods
 
+void AGMosaicStitcher::logTransformBetweenImages(const string &message, const AGImage &imageOne, const AGImage &imageTwo)
+{
+    // Pairs are registered concurrently, so whole message is written at once
+    static mutex logMutex;
+    AGError error;
+    stringstream log;
+    log << message << endl;
+    log << "1. " << AGOpenCVHelper::getDescriptionOfImage(imageOne, error) << endl;
+    log << "2. " << AGOpenCVHelper::getDescriptionOfImage(imageTwo, error) << endl << endl;
+    lock_guard<mutex> lock(logMutex);
+    cout << log.str();
+}
+
 void AGMosaicStitcher::clusterArrayWithinRange(vector<double> &array, vector<double> &output, double rangeParameter)
 {
     vector<double> sortedArray = array;
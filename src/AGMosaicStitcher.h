@@ -9,9 +9,16 @@
 #include "AGDataStructures.h"
 #include "AGPathDetection.h"
 #include "AGOpenCVHelper.h"
+#include "AGFeatureCache.h"
+#include "AGRunReport.h"
+#include "AGFeatureExtractor.h"
+#include "AGMatchTable.h"
+#include "AGRegistrationEngine.h"
 
 #include <stdio.h>
 #include <vector>
+#include <memory>
+#include <atomic>
 #include <opencv2/stitching/stitcher.hpp>
 #include <opencv2/opencv.hpp>
 
@@ -23,65 +30,113 @@ public:
     /**
      *  Constructor of AGMosaicStitcher object.
      *
-     *  @params parameters Loaded parameters from configuration file.
+     *  @params parameters   Loaded parameters from configuration file.
+     *  @params featureCache Store of features shared by all stitchers of the same mosaic (features are not cached
+     *                       when it is nullptr).
+     *  @params runReport    Report to which times of stages and counters are added (can be nullptr).
      */
-    AGMosaicStitcher(const AGParameters &parameters);
+    AGMosaicStitcher(const AGParameters &parameters,
+                     AGFeatureCache *featureCache = nullptr,
+                     AGRunReport *runReport = nullptr);
     
     /**
-     *  Starting point of whole stitching process. Takes matrix of tiles and produces mosaic.
+     *  Starting point of whole stitching process. Takes matrix of tiles and produces mosaic. Tiles are not modified,
+     *  so the same loaded tiles can be stitched with different parameters.
      *
-     *  @param imagesMatrix Matrix of image tiles.
-     *  @param outputImage  Output Mosaic.
+     *  @param tilesMatrix Matrix of image tiles.
+     *  @param outputImage Output Mosaic.
      *
      *  @return Error code (EXIT_SUCCESS or EXIT_FAILURE).
      */
-    int stitchMosaic(std::vector<std::vector<AGImage>> &imagesMatrix, cv::Mat &outputImage);
+    int stitchMosaic(const std::vector<std::vector<AGImage>> &tilesMatrix, cv::Mat &outputImage);
+    
+    /**
+     *  First stage of stitching process. Finds transformations of all tiles, result is kept in the stitcher until
+     *  composeMosaic(...) is called.
+     *
+     *  @param tilesMatrix Matrix of image tiles.
+     *
+     *  @return Error code (EXIT_SUCCESS or EXIT_FAILURE).
+     */
+    int registerMosaic(const std::vector<std::vector<AGImage>> &tilesMatrix);
+    
+    /**
+     *  Second stage of stitching process. Warps registered tiles onto mosaic plane and blends them.
+     *
+     *  @param outputImage Output Mosaic.
+     *
+     *  @return Error code (EXIT_SUCCESS or EXIT_FAILURE).
+     */
+    int composeMosaic(cv::Mat &outputImage);
 private:
     
     /**
-     *  Starting point of algorithm. At this point all necessary matrices are initialized.
+     *  Starting point of algorithm. At this point all necessary matrices are initialized. Registers all pairs of
+     *  neighbouring images and composes global transformations.
      *
      *  @param imagesMatrix Matrix of image tiles.
+     */
+    void performRegistration(std::vector<std::vector<AGImage>> &imagesMatrix);
+    
+    /**
+     *  Places registered images on the mosaic plane and blends them.
+     *
+     *  @param imagesMatrix Matrix of registered image tiles.
      *  @param outputImage  Output mosaic.
      */
-    void performStitching(std::vector<std::vector<AGImage>> &imagesMatrix, cv::Mat &outputImage);
+    void performComposition(std::vector<std::vector<AGImage>> &imagesMatrix, cv::Mat &outputImage);
+
+    /**
+     *  Composes chain of transformations between neighbouring tiles (and the base shift) into one global
+     *  transformation for every image. Result is assigned to globalTransform property of every image.
+     *
+     *  @param imagesMatrix Matrix of image tiles.
+     */
+    void composeGlobalTransforms(std::vector<std::vector<AGImage>> &imagesMatrix);
+
+    /**
+     *  Warps every image and its mask exactly once onto the final mosaic plane using its global transformation.
+     *  Only bounding box of transformed image is resampled and kept (image and mask get the size of bounding box).
+     *
+     *  @param imagesMatrix Matrix of image tiles.
+     *  @param planeSize    Size of the final mosaic plane.
+     */
+    void warpImagesOntoMosaicPlane(std::vector<std::vector<AGImage>> &imagesMatrix, const cv::Size &planeSize);
 
     /**
      *  Filters matches that the output matches are from only one keypoint to only one keypoint.
      *  The situations in which one keypoint is matched to multiple is eliminated.
      *
-     *  @param matches        Input matches.
-     *  @param filtredMatches Output filtered matches.
+     *  @param matchTable Matches (filtered in place).
      */
-    void deleteMatchesFromMultipleKeypointsToMultiple(std::vector<cv::DMatch> &matches,
-                                                      std::vector<cv::DMatch> &filtredMatches);
+    void deleteMatchesFromMultipleKeypointsToMultiple(AGMatchTable &matchTable);
     
     /**
-     *  Filters matched using RANSAC algorithm.
+     *  Filters matched using robust estimator (PROSAC sampling with adaptive termination, see AGRobustEstimator) of
+     *  the model returned by transformModel(). Only inliers of estimated model are kept.
      *
-     *  @param imageOne       First image.
-     *  @param imageTwo       Second image.
-     *  @param matches        Input matches between first image and second image.
-     *  @param filtredMatches Output filtered matches.
+     *  @param matchTable Matches between first image and second image (filtered in place).
+     */
+    void filterMatchesUsingRANSAC(AGMatchTable &matchTable);
+    
+    /**
+     *  Returns model of transform between images used by current stitching version.
+     *
+     *  @return TranslationModel for simpler transform, rigidTransformModel parameter otherwise.
      */
-    void filterMatchesUsingRANSAC(AGImage &imageOne,
-                                  AGImage &imageTwo,
-                                  std::vector<cv::DMatch> &matches,
-                                  std::vector<cv::DMatch> &filtredMatches);
+    AGTransformModel transformModel();
     
     /**
      *  Filters matches based on slope and length of vector that connects keypoints of the match.
      *
      *  @param imageOne       First image.
      *  @param imageTwo       Second image.
-     *  @param matches        Input matches between first image and second image.
-     *  @param filtredMatches Output filtered matches.
+     *  @param matchTable     Matches between first image and second image (filtered in place).
      *  @param imageDirection Stitching direction (see ImageDirection enum in AGDataStructures.h).
      */
     void filterMatchesBasedOnSlopeAndLength(AGImage &imageOne,
                                             AGImage &imageTwo,
-                                            std::vector<cv::DMatch> &matches,
-                                            std::vector<cv::DMatch> &filtredMatches,
+                                            AGMatchTable &matchTable,
                                             ImageDirection imageDirection);
     
     /**
@@ -89,18 +144,32 @@ private:
      *
      *  @param imageOne       First image.
      *  @param imageTwo       Second image.
-     *  @param matches        Input matches between first image and second image.
-     *  @param filtredMatches Output filtered matches.
+     *  @param matchTable     Matches between first image and second image (filtered in place).
      *  @param imageDirection Stitching direction (see ImageDirection enum in AGDataStructures.h).
      */
     void filterMatchesBasedOnPlacement(AGImage &imageOne,
                                        AGImage &imageTwo,
-                                       std::vector<cv::DMatch> &matches,
-                                       std::vector<cv::DMatch> &filtredMatches,
+                                       AGMatchTable &matchTable,
                                        ImageDirection imageDirection);
     
     /**
-     *  Filters matches.
+     *  Draws matches from the table on both images and saves result (testing purpose).
+     *
+     *  @param imageOne       First image.
+     *  @param imageTwo       Second image.
+     *  @param matchTable     Matches between first image and second image.
+     *  @param name           Name of saved image.
+     *  @param imageDirection Stitching direction (see ImageDirection enum in AGDataStructures.h).
+     */
+    void saveMatchesOfTable(AGImage &imageOne,
+                            AGImage &imageTwo,
+                            const AGMatchTable &matchTable,
+                            const std::string &name,
+                            ImageDirection imageDirection);
+    
+    /**
+     *  Filters matches. Matches go through all filters in one AGMatchTable (one table per thread, reused by next
+     *  pairs), filters remove matches from it in place.
      *
      *  @param imageOne       First image.
      *  @param imageTwo       Second image.
@@ -115,18 +184,106 @@ private:
                        ImageDirection imageDirection);
     
     /**
-     *  Stitches two images. Produces transformation matrix between those images.
+     *  Adds pair of neighbouring images to the list of registrations.
+     *
+     *  @param imagePairs          List of registrations.
+     *  @param imageOneCoordinates Coordinates of the first (transformed) image in images matrix.
+     *  @param imageTwoCoordinates Coordinates of the second image in images matrix.
+     *  @param imageDirection      Stitching direction (see ImageDirection enum in AGDataStructures.h).
+     */
+    void addImagePair(std::vector<AGImagePair> &imagePairs,
+                      cv::Point imageOneCoordinates,
+                      cv::Point imageTwoCoordinates,
+                      ImageDirection imageDirection);
+
+    /**
+     *  Registers all pairs of images in parallel (number of threads is taken from parameters). Results are
+     *  written to transformsMatrix and don't depend on number of threads.
+     *
+     *  @param imagesMatrix Matrix of image tiles.
+     *  @param imagePairs   List of registrations.
+     */
+    void registerImagePairs(std::vector<std::vector<AGImage>> &imagesMatrix, std::vector<AGImagePair> &imagePairs);
+
+    /**
+     *  Stitches two images. Produces transformation matrix between those images. Path based transform (when usePaths
+     *  is set) and registration engines are tried in order, cheapest first. Features are extracted only when all of
+     *  them are rejected. Result is optionally refined with ECC. Tiles are only read, so the same tile can be
+     *  registered with its neighbours at the same time.
+     *
+     *  @param tileOne        First image.
+     *  @param tileTwo        Second image.
+     *  @param imageDirection Stitching direction (see ImageDirection enum in AGDataStructures.h).
+     *  @param transform      Output transformation matrix between images (the second one is transformed).
+     */
+    void applyStitchingAlgorithm(const AGImage &tileOne,
+                                 const AGImage &tileTwo,
+                                 ImageDirection imageDirection,
+                                 cv::Mat &transform);
+
+    /**
+     *  Registers two images with transform based on detected blood vessels paths (see findTransformBasedOnPaths(...)).
      *
      *  @param imageOne       First image.
      *  @param imageTwo       Second image.
      *  @param imageDirection Stitching direction (see ImageDirection enum in AGDataStructures.h).
      *  @param transform      Output transformation matrix between images (the second one is transformed).
+     *
+     *  @return Indicates if transformation matrix was found.
      */
-    void applyStitchingAlgorithm(AGImage &imageOne,
-                                 AGImage &imageTwo,
+    bool registerImagesWithPaths(const AGImage &imageOne,
+                                 const AGImage &imageTwo,
                                  ImageDirection imageDirection,
                                  cv::Mat &transform);
 
+    /**
+     *  Registers two images with registration engine. Transform is accepted only when confidence of engine is at
+     *  least registrationConfidence parameter and its consistency (see AGRegistrationEngine) is at least
+     *  consistencyThreshold parameter.
+     *
+     *  @param engine         Registration engine.
+     *  @param imageOne       First image.
+     *  @param imageTwo       Second image.
+     *  @param imageDirection Stitching direction (see ImageDirection enum in AGDataStructures.h).
+     *  @param transform      Output transformation matrix between images (the second one is transformed).
+     *
+     *  @return Indicates if transformation matrix was found and accepted.
+     */
+    bool registerImagesWithEngine(const AGRegistrationEngine &engine,
+                                  const AGImage &imageOne,
+                                  const AGImage &imageTwo,
+                                  ImageDirection imageDirection,
+                                  cv::Mat &transform);
+
+    /**
+     *  Registers two images with features: extracts features in overlap regions, matches and filters them and
+     *  calculates transformation matrix with findTransformBetweenImages(...).
+     *
+     *  @param tileOne        First image.
+     *  @param tileTwo        Second image.
+     *  @param imageDirection Stitching direction (see ImageDirection enum in AGDataStructures.h).
+     *  @param transform      Output transformation matrix between images (the second one is transformed).
+     */
+    void registerImagesWithFeatures(const AGImage &tileOne,
+                                    const AGImage &tileTwo,
+                                    ImageDirection imageDirection,
+                                    cv::Mat &transform);
+
+    /**
+     *  Refines transformation between two images with AGECCRefinement on overlap region of the first image. Model of
+     *  refined transformation follows stitching version (translation unless rigidTransform is set). Transformation
+     *  is not changed when refinement fails.
+     *
+     *  @param imageOne       First image.
+     *  @param imageTwo       Second image.
+     *  @param imageDirection Stitching direction (see ImageDirection enum in AGDataStructures.h).
+     *  @param transform      Transformation matrix between images (input and output).
+     */
+    void refineTransformWithECC(const AGImage &imageOne,
+                                const AGImage &imageTwo,
+                                ImageDirection imageDirection,
+                                cv::Mat &transform);
+
     /**
      *  Extract features of two images in their region of interest (ROI) based on image direction.
      *
@@ -141,16 +298,54 @@ private:
                       ImageDirection imageDirection);
     
     /**
-     *  Extracts SIFT features in ROI of input image.
+     *  Extracts features in ROI of input image with features extractor selected in parameters. Detector runs on ROI
+     *  cropped with margin, keypoints are returned in image coordinates.
      *
      *  @param inputImage    Input image.
      *  @param imageFeatures Output image features.
      *  @param roi           Region of interest.
      */
-    void findFeaturesWithSIFT(AGImage &inputImage, cv::detail::ImageFeatures &imageFeatures, cv::Rect &roi);
+    void findFeaturesWithExtractor(AGImage &inputImage, cv::detail::ImageFeatures &imageFeatures, cv::Rect &roi);
+    
+    /**
+     *  Extracts features in overlap region of image on given side. Features are taken from the feature cache when
+     *  they were already extracted.
+     *
+     *  @param inputImage    Input image.
+     *  @param side          Side of image on which the neighbour is placed.
+     *  @param imageFeatures Output image features (keypoints in image coordinates).
+     */
+    void findFeaturesInOverlapOfImage(AGImage &inputImage,
+                                      ImageDirection side,
+                                      cv::detail::ImageFeatures &imageFeatures);
     
     /**
-     *  Finds matches between keypoints using Brute Force algorithm.
+     *  Returns description of features detector and its parameters (part of the feature cache key).
+     *
+     *  @return Description of detector.
+     */
+    std::string detectorDescription();
+    
+    /**
+     *  Finds matches between keypoints of two images. When guidedMatching parameter is set only keypoints within
+     *  shiftParameter of location predicted by findShiftTransform(...) are compared, otherwise
+     *  findMatchesWithBruteForce(...) is used.
+     *
+     *  @param imageOne       First image.
+     *  @param imageTwo       Second image.
+     *  @param imagesFeatures Input keypoints vector (features of first and second image).
+     *  @param matchesInfo    Output matches.
+     *  @param imageDirection Stitching direction (see ImageDirection enum in AGDataStructures.h).
+     */
+    void findMatches(AGImage &imageOne,
+                     AGImage &imageTwo,
+                     std::vector<cv::detail::ImageFeatures> &imagesFeatures,
+                     cv::detail::MatchesInfo &matchesInfo,
+                     ImageDirection imageDirection);
+    
+    /**
+     *  Finds matches between keypoints (mutual nearest neighbours, optionally with ratio test). Exact brute force or
+     *  approximate FLANN backend is used depending on parameters (see AGDescriptorMatcher).
      *
      *  @param imagesFeatures Input keypoints vector.
      *  @param matchesInfo    Output matches.
@@ -195,8 +390,8 @@ private:
      *
      *  @return Indicates if transformation matrix was found.
      */
-    bool findTransformBasedOnPaths(AGImage &imageOne,
-                                   AGImage &imageTwo,
+    bool findTransformBasedOnPaths(const AGImage &imageOne,
+                                   const AGImage &imageTwo,
                                    cv::Mat &transform,
                                    ImageDirection imageDirection);
     
@@ -210,7 +405,24 @@ private:
      *
      *  @return Indicates if point was selected.
      */
-    bool selectPointFromPath(AGImage &image, ImageDirection desiredPlace, cv::Point &point);
+    bool selectPointFromPath(const AGImage &image, ImageDirection desiredPlace, cv::Point &point);
+
+    /**
+     *  Prints information about transformation found between two images. Safe to call from multiple threads.
+     *
+     *  @param message  Description of found transformation.
+     *  @param imageOne First image.
+     *  @param imageTwo Second image.
+     */
+    void logTransformBetweenImages(const std::string &message, const AGImage &imageOne, const AGImage &imageTwo);
+
+    /**
+     *  Increases counter in the run report (if there is one).
+     *
+     *  @param counter Name of the counter.
+     *  @param value   Value to add.
+     */
+    void increaseCounter(const std::string &counter, long value = 1);
 
     /**
      *  Not used. Experimental method that was clustering values in array within given range parameter.
@@ -257,6 +469,27 @@ private:
      */
     AGPathDetection *pathDetection;
     
+    /**
+     *  Store of features extracted from overlap regions of tiles (not owned).
+     */
+    AGFeatureCache *featureCache;
+    
+    /**
+     *  Report of times of stages and counters (not owned).
+     */
+    AGRunReport *runReport;
+    
+    /**
+     *  Detector and descriptor of features (selected by featureExtractor parameter).
+     */
+    std::shared_ptr<AGFeatureExtractor> featureExtractor;
+    
+    /**
+     *  Tiers of registration tried in order before features (selected by registrationTiers or registrationEngine
+     *  parameter, empty when only features are used).
+     */
+    std::vector<std::shared_ptr<AGRegistrationEngine>> registrationEngines;
+    
     /**
      *  Loaded parameters from configuration file.
      */
@@ -277,10 +510,25 @@ private:
      */
     bool testingMode;
     
+    /**
+     *  Indicates if matching benchmark (benchmarkMode parameter) was already run on a pair of this mosaic.
+     */
+    std::atomic<bool> isMatchingBenchmarked;
+    
     /**
      *  Matrix of transformation matrices between tile images.
      */
     std::vector<std::vector<cv::Mat>> transformsMatrix;
+    
+    /**
+     *  Working copy of tiles matrix (shares pixel data with loaded tiles) between registration and composition.
+     */
+    std::vector<std::vector<AGImage>> imagesMatrix;
+    
+    /**
+     *  Size of the final mosaic plane.
+     */
+    cv::Size mosaicSize;
 };
 
 #endif /* defined(__Mosaic_Stitcher__AGMosaicStitcher__) */
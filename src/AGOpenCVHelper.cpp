@@ -6,6 +6,7 @@
 #include "AGOpenCVHelper.h"
 
 #include <fstream>
+#include <cfloat>
 
 using namespace cv;
 using namespace std;
@@ -70,6 +71,43 @@ double AGOpenCVHelper::distanceBetweenPoints(const Point &pointOne, const Point
     return sqrt(pow(pointOne.x - pointTwo.x, 2.0) + pow(pointOne.y - pointTwo.y, 2.0));
 }
 
+Rect AGOpenCVHelper::overlapRegionOfImage(const cv::Size &imageSize, const ImageDirection side, const double percentOverlap)
+{
+    Rect region;
+    switch (side) {
+        case Up:
+            region = Rect(0, 0, imageSize.width, (double)imageSize.height * percentOverlap);
+            break;
+        case Down:
+            region = Rect(0, (double)imageSize.height * (1.0 - percentOverlap),
+                          imageSize.width, (double)imageSize.height * percentOverlap);
+            break;
+        case Left:
+            region = Rect(0, 0, (double)imageSize.width * percentOverlap, imageSize.height);
+            break;
+        case Right:
+            region = Rect((double)imageSize.width * (1.0 - percentOverlap), 0,
+                          (double)imageSize.width * percentOverlap, imageSize.height);
+            break;
+    }
+    return region;
+}
+
+ImageDirection AGOpenCVHelper::oppositeDirection(const ImageDirection imageDirection)
+{
+    switch (imageDirection) {
+        case Up:
+            return Down;
+        case Down:
+            return Up;
+        case Left:
+            return Right;
+        case Right:
+            return Left;
+    }
+    return imageDirection;
+}
+
 #pragma mark - Image creation
 
 void AGOpenCVHelper::createEmptyMatWithSize(cv::Mat &image, const cv::Size &size, const int imageType)
@@ -139,6 +177,47 @@ void AGOpenCVHelper::createShiftMatrix(cv::Mat &shiftMatrix, const double dx, co
     shiftMatrix = (Mat_<double>(2,3) << 1, 0, dx, 0, 1, dy);
 }
 
+void AGOpenCVHelper::convertAffineToHomogeneous(const cv::Mat &affineMatrix, cv::Mat &homogeneousMatrix)
+{
+    homogeneousMatrix = Mat::eye(3, 3, CV_64F);
+    Mat affine;
+    affineMatrix.convertTo(affine, CV_64F);
+    affine.rowRange(0, 2).copyTo(homogeneousMatrix.rowRange(0, 2));
+}
+
+void AGOpenCVHelper::shiftCoordinatesOfTransform(const cv::Mat &transform,
+                                                 const double dx,
+                                                 const double dy,
+                                                 cv::Mat &shiftedTransform)
+{
+    Mat shift, inverseShift, homogeneousTransform, homogeneousInverseShift;
+    AGOpenCVHelper::createShiftMatrix(shift, dx, dy);
+    AGOpenCVHelper::createShiftMatrix(inverseShift, -dx, -dy);
+    AGOpenCVHelper::convertAffineToHomogeneous(transform, homogeneousTransform);
+    AGOpenCVHelper::convertAffineToHomogeneous(inverseShift, homogeneousInverseShift);
+    shiftedTransform = shift * homogeneousTransform * homogeneousInverseShift;
+}
+
+Rect AGOpenCVHelper::boundingBoxOfTransformedImage(const cv::Size &imageSize,
+                                                   const cv::Mat &transform,
+                                                   const cv::Size &planeSize)
+{
+    Mat affine;
+    transform.rowRange(0, 2).convertTo(affine, CV_64F);
+    vector<Point2d> corners = { Point2d(0, 0), Point2d(imageSize.width, 0),
+                                Point2d(0, imageSize.height), Point2d(imageSize.width, imageSize.height) };
+    double minX = DBL_MAX, minY = DBL_MAX, maxX = -DBL_MAX, maxY = -DBL_MAX;
+    for (auto &corner : corners) {
+        double x = affine.at<double>(0, 0) * corner.x + affine.at<double>(0, 1) * corner.y + affine.at<double>(0, 2);
+        double y = affine.at<double>(1, 0) * corner.x + affine.at<double>(1, 1) * corner.y + affine.at<double>(1, 2);
+        minX = min(minX, x); maxX = max(maxX, x);
+        minY = min(minY, y); maxY = max(maxY, y);
+    }
+    // One pixel margin, because bilinear interpolation spreads the border pixels
+    Rect boundingBox(Point((int)floor(minX) - 1, (int)floor(minY) - 1), Point((int)ceil(maxX) + 1, (int)ceil(maxY) + 1));
+    return boundingBox & Rect(Point(), planeSize);
+}
+
 void AGOpenCVHelper::rotateImage(cv::Mat &image, const double angle)
 {
     int len = max(image.cols, image.rows);
@@ -294,7 +373,8 @@ void AGOpenCVHelper::linkTwoImagesTogetherAndDrawMatches(const AGImage &imageOne
 void AGOpenCVHelper::saveImage(cv::Mat &image,
                                const std::string &imageName,
                                const std::string &savePath,
-                               AGError &error)
+                               AGError &error,
+                               const std::string &extension)
 {
     if (imageName.empty() || savePath.empty()) {
         error = { true, "saveImage: imageName or savePath is empty." }; return;
@@ -302,7 +382,7 @@ void AGOpenCVHelper::saveImage(cv::Mat &image,
     if (!image.data) {
         error = { true, "saveImage: imageName or savePath is empty." }; return;
     }
-    string path = savePath + "/" + imageName + ".png";
+    string path = savePath + "/" + imageName + "." + extension;
     if (image.type() == CV_8UC4) {
         cvtColor(image, image, CV_BGRA2BGR);
     }
@@ -116,6 +116,26 @@ public:
                                             const int pixelValue,
                                             AGError &error);
     
+    /**
+     *  Returns region of image that overlaps with neighbouring image placed on given side.
+     *
+     *  @param imageSize      Size of image.
+     *  @param side           Side of image on which the neighbour is placed.
+     *  @param percentOverlap Overlap between neighbouring images (fraction of image size).
+     *
+     *  @return Overlap region (strip along the given side).
+     */
+    static cv::Rect overlapRegionOfImage(const cv::Size &imageSize, const ImageDirection side, const double percentOverlap);
+    
+    /**
+     *  Returns direction opposite to given direction.
+     *
+     *  @param imageDirection Direction.
+     *
+     *  @return Opposite direction.
+     */
+    static ImageDirection oppositeDirection(const ImageDirection imageDirection);
+    
     /**
      *  Creates shif matrix with given parameters.
      *
@@ -124,7 +144,43 @@ public:
      *  @param dy          Translation in y axis.
      */
     static void createShiftMatrix(cv::Mat &shiftMatrix, const double dx, const double dy);
-    
+
+    /**
+     *  Converts 2x3 affine transformation matrix to 3x3 homogeneous matrix, so it can be composed with other
+     *  transformations by matrix multiplication.
+     *
+     *  @param affineMatrix      Input 2x3 affine matrix.
+     *  @param homogeneousMatrix Output 3x3 matrix (CV_64F).
+     */
+    static void convertAffineToHomogeneous(const cv::Mat &affineMatrix, cv::Mat &homogeneousMatrix);
+
+    /**
+     *  Expresses transformation in coordinates shifted by (dx, dy), i.e. calculates S * T * S^-1 where S is shift
+     *  matrix.
+     *
+     *  @param transform        Input 2x3 affine matrix.
+     *  @param dx               Shift of coordinates in x axis.
+     *  @param dy               Shift of coordinates in y axis.
+     *  @param shiftedTransform Output 2x3 affine matrix (CV_64F).
+     */
+    static void shiftCoordinatesOfTransform(const cv::Mat &transform,
+                                            const double dx,
+                                            const double dy,
+                                            cv::Mat &shiftedTransform);
+
+    /**
+     *  Calculates bounding box of image with given size after transformation, clipped to the plane.
+     *
+     *  @param imageSize Size of image before transformation.
+     *  @param transform 2x3 or 3x3 transformation matrix.
+     *  @param planeSize Size of the plane to which image is transformed.
+     *
+     *  @return Bounding box of transformed image (empty when image is outside the plane).
+     */
+    static cv::Rect boundingBoxOfTransformedImage(const cv::Size &imageSize,
+                                                  const cv::Mat &transform,
+                                                  const cv::Size &planeSize);
+
     /**
      *  Rotates the image by given angle.
      *
@@ -180,14 +236,19 @@ public:
                                                     AGError &error);
 
     /**
-     *  Saves image to disc.
+     *  Saves image to disc. Single channel images are written as they are (without conversion to color).
      *
-     *  @param image    Image to save.
-     *  @param name     Name of image file.
-     *  @param savePath Path to save.
-     *  @param error    Error.
+     *  @param image     Image to save.
+     *  @param name      Name of image file.
+     *  @param savePath  Path to save.
+     *  @param error     Error.
+     *  @param extension Extension of image file, defines image format ("png" or "tiff").
      */
-    static void saveImage(cv::Mat &image, const std::string &name, const std::string &savePath, AGError &error);
+    static void saveImage(cv::Mat &image,
+                          const std::string &name,
+                          const std::string &savePath,
+                          AGError &error,
+                          const std::string &extension = "png");
     
     /**
      *  Saves detected keypoints vector to file.
@@ -44,6 +44,7 @@ void AGPathDetection::detectPaths(cv::vector<cv::vector<AGImage>> &imagesMatrix)
             Mat skeleton;
             this->prepareForPathDetecting(imagesMatrix[x][y].image, skeleton);
             this->searchForPathsInImageUsingSkeleton(imagesMatrix[x][y], skeleton);
+            imagesMatrix[x][y].skeleton = skeleton;
             this->testDetectedPathsInImage(imagesMatrix[x][y]);
         }
     }
@@ -39,7 +39,7 @@ public:
     AGPathDetection(const AGParameters &parameters);
     
     /**
-     *  Detects path in every image of imagesMatrix.
+     *  Detects path in every image of imagesMatrix. Skeleton of every image is kept in its skeleton property.
      *
      *  @param imagesMatrix Matrix of images.
      */
@@ -0,0 +1,118 @@
+//
+//  Created by Aleksander Grzyb on 21/09/15.
+//  Copyright (c) 2015 Aleksander Grzyb. All rights reserved.
+//
+
+#include "AGPhaseCorrelationEngine.h"
+#include "AGOpenCVHelper.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+
+using namespace cv;
+using namespace std;
+
+AGPhaseCorrelationEngine::AGPhaseCorrelationEngine(const AGParameters &parameters) : AGRegistrationEngine(parameters)
+{
+}
+
+#pragma mark -
+#pragma mark Registration
+
+bool AGPhaseCorrelationEngine::registerImages(const AGImage &imageOne,
+                                              const AGImage &imageTwo,
+                                              ImageDirection imageDirection,
+                                              Mat &transform,
+                                              double &confidence) const
+{
+    confidence = 0.0;
+    Mat stripOne, stripTwo;
+    Point2d stripOffset;
+    if (!this->extractOverlapStrips(imageOne, imageTwo, imageDirection, stripOne, stripTwo, stripOffset)) {
+        return false;
+    }
+    Point2d shift;
+    if (!AGPhaseCorrelationEngine::correlateImages(stripOne, stripTwo, this->maximalShiftOfImage(imageOne), shift, confidence)) {
+        return false;
+    }
+    AGOpenCVHelper::createShiftMatrix(transform, stripOffset.x + shift.x, stripOffset.y + shift.y);
+    return true;
+}
+
+const char *AGPhaseCorrelationEngine::name() const
+{
+    return "phaseCorrelation";
+}
+
+#pragma mark -
+#pragma mark Phase Correlation
+
+bool AGPhaseCorrelationEngine::correlateImages(const Mat &imageOne,
+                                               const Mat &imageTwo,
+                                               const Size &maximalShift,
+                                               Point2d &shift,
+                                               double &confidence)
+{
+    confidence = 0.0;
+    if (imageOne.empty() || imageOne.size() != imageTwo.size() || imageOne.type() != CV_32F || imageTwo.type() != CV_32F
+        || imageOne.rows < 3 || imageOne.cols < 3) {
+        return false;
+    }
+    Size dftSize(getOptimalDFTSize(imageOne.cols), getOptimalDFTSize(imageOne.rows));
+    Mat window;
+    createHanningWindow(window, imageOne.size(), CV_32F);
+
+    Mat spectrumOne, spectrumTwo, crossPowerSpectrum;
+    AGPhaseCorrelationEngine::spectrumOfImage(imageOne, window, dftSize, spectrumOne);
+    AGPhaseCorrelationEngine::spectrumOfImage(imageTwo, window, dftSize, spectrumTwo);
+    // Spectrum of second image times conjugated spectrum of first one has its peak at +shift
+    mulSpectrums(spectrumTwo, spectrumOne, crossPowerSpectrum, 0, true);
+    for (int y = 0; y < crossPowerSpectrum.rows; ++y) {
+        Vec2f *row = crossPowerSpectrum.ptr<Vec2f>(y);
+        for (int x = 0; x < crossPowerSpectrum.cols; ++x) {
+            float magnitude = sqrt(row[x][0] * row[x][0] + row[x][1] * row[x][1]);
+            float inverseMagnitude = magnitude > FLT_EPSILON ? 1.0f / magnitude : 0.0f;
+            row[x][0] *= inverseMagnitude;
+            row[x][1] *= inverseMagnitude;
+        }
+    }
+    Mat correlation;
+    idft(crossPowerSpectrum, correlation, DFT_SCALE);
+    extractChannel(correlation, correlation, 0);
+
+    // Shifts are wrapped around the borders of correlation surface
+    int maximalX = min(maximalShift.width, (dftSize.width - 1) / 2);
+    int maximalY = min(maximalShift.height, (dftSize.height - 1) / 2);
+    auto valueAt = [&](int dx, int dy) {
+        return correlation.at<float>((dy + dftSize.height) % dftSize.height, (dx + dftSize.width) % dftSize.width);
+    };
+    int peakX = 0, peakY = 0;
+    float peakValue = -FLT_MAX;
+    for (int dy = -maximalY; dy <= maximalY; ++dy) {
+        for (int dx = -maximalX; dx <= maximalX; ++dx) {
+            float value = valueAt(dx, dy);
+            if (value > peakValue) {
+                peakValue = value;
+                peakX = dx;
+                peakY = dy;
+            }
+        }
+    }
+
+    double offsetX = AGRegistrationEngine::parabolaVertexOffset(valueAt(peakX - 1, peakY), peakValue, valueAt(peakX + 1, peakY));
+    double offsetY = AGRegistrationEngine::parabolaVertexOffset(valueAt(peakX, peakY - 1), peakValue, valueAt(peakX, peakY + 1));
+    shift = Point2d(peakX + offsetX, peakY + offsetY);
+    confidence = min(max((double)peakValue, 0.0), 1.0);
+    return true;
+}
+
+void AGPhaseCorrelationEngine::spectrumOfImage(const Mat &image, const Mat &window, const Size &dftSize, Mat &spectrum)
+{
+    Mat windowedImage = image - mean(image)[0];
+    multiply(windowedImage, window, windowedImage);
+    Mat paddedImage;
+    copyMakeBorder(windowedImage, paddedImage, 0, dftSize.height - image.rows, 0, dftSize.width - image.cols,
+                   BORDER_CONSTANT, Scalar::all(0));
+    dft(paddedImage, spectrum, DFT_COMPLEX_OUTPUT);
+}
@@ -0,0 +1,68 @@
+//
+//  Created by Aleksander Grzyb on 21/09/15.
+//  Copyright (c) 2015 Aleksander Grzyb. All rights reserved.
+//
+
+#ifndef __Mosaic_Stitcher__AGPhaseCorrelationEngine__
+#define __Mosaic_Stitcher__AGPhaseCorrelationEngine__
+
+#include "AGRegistrationEngine.h"
+
+#include <stdio.h>
+#include <opencv2/opencv.hpp>
+
+ /// Registers overlap regions of tiles with phase correlation (FFT of both strips, normalized cross-power spectrum
+ /// and its peak). Finds only translation, with sub-pixel precision, and the height of the peak is the confidence.
+
+class AGPhaseCorrelationEngine : public AGRegistrationEngine {
+public:
+
+    /**
+     *  Constructor of AGPhaseCorrelationEngine object.
+     *
+     *  @param parameters Loaded parameters from configuration file.
+     */
+    AGPhaseCorrelationEngine(const AGParameters &parameters);
+
+    bool registerImages(const AGImage &imageOne,
+                        const AGImage &imageTwo,
+                        ImageDirection imageDirection,
+                        cv::Mat &transform,
+                        double &confidence) const;
+
+    const char *name() const;
+
+    /**
+     *  Finds translation between two images of the same size with phase correlation. Images are windowed (Hanning
+     *  window) and padded to optimal size of DFT. Peak is searched only within maximalShift and refined to sub-pixel
+     *  precision with parabola fitted to its neighbours in both axes.
+     *
+     *  @param imageOne     First image (single channel, CV_32F).
+     *  @param imageTwo     Second image (single channel, CV_32F).
+     *  @param maximalShift Maximal translation in x and y axis.
+     *  @param shift        Output translation (pixel at point p of first image lies at p + shift of second image).
+     *  @param confidence   Output height of the peak (1 for identical shifted images, close to 0 without
+     *                      correlation).
+     *
+     *  @return Indicates if translation was found.
+     */
+    static bool correlateImages(const cv::Mat &imageOne,
+                                const cv::Mat &imageTwo,
+                                const cv::Size &maximalShift,
+                                cv::Point2d &shift,
+                                double &confidence);
+
+private:
+
+    /**
+     *  Computes spectrum of image (mean is subtracted, image is windowed and padded with zeros).
+     *
+     *  @param image    Input image (single channel, CV_32F).
+     *  @param window   Hanning window of image size.
+     *  @param dftSize  Size of DFT.
+     *  @param spectrum Output complex spectrum.
+     */
+    static void spectrumOfImage(const cv::Mat &image, const cv::Mat &window, const cv::Size &dftSize, cv::Mat &spectrum);
+};
+
+#endif /* defined(__Mosaic_Stitcher__AGPhaseCorrelationEngine__) */
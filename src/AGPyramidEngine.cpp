@@ -0,0 +1,113 @@
+//
+//  Created by Aleksander Grzyb on 21/09/15.
+//  Copyright (c) 2015 Aleksander Grzyb. All rights reserved.
+//
+
+#include "AGPyramidEngine.h"
+#include "AGPhaseCorrelationEngine.h"
+#include "AGOpenCVHelper.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace cv;
+using namespace std;
+
+AGPyramidEngine::AGPyramidEngine(const AGParameters &parameters) : AGRegistrationEngine(parameters)
+{
+}
+
+#pragma mark -
+#pragma mark Registration
+
+bool AGPyramidEngine::registerImages(const AGImage &imageOne,
+                                     const AGImage &imageTwo,
+                                     ImageDirection imageDirection,
+                                     Mat &transform,
+                                     double &confidence) const
+{
+    confidence = 0.0;
+    Mat stripOne, stripTwo;
+    Point2d stripOffset;
+    if (!this->extractOverlapStrips(imageOne, imageTwo, imageDirection, stripOne, stripTwo, stripOffset)) {
+        return false;
+    }
+
+    // Thin strips (e.g. small percentOverlap) are downsampled less than pyramidLevels times
+    Mat coarseStripOne = stripOne, coarseStripTwo = stripTwo;
+    int scale = 1;
+    for (int level = 0; level < this->parameters.pyramidLevels
+         && min(coarseStripOne.rows, coarseStripOne.cols) >= 2 * PYRAMID_ENGINE_MINIMAL_TEMPLATE_SIZE; ++level) {
+        pyrDown(coarseStripOne, coarseStripOne);
+        pyrDown(coarseStripTwo, coarseStripTwo);
+        scale *= 2;
+    }
+    Size maximalShift = this->maximalShiftOfImage(imageOne);
+    Size coarseMaximalShift(max(maximalShift.width / scale, 1), max(maximalShift.height / scale, 1));
+    Point2d shift;
+    double coarseConfidence;
+    if (!AGPhaseCorrelationEngine::correlateImages(coarseStripOne, coarseStripTwo, coarseMaximalShift, shift, coarseConfidence)) {
+        return false;
+    }
+
+    // Coarse estimate is accurate to about one pixel of the coarsest level
+    shift *= scale;
+    if (!AGPyramidEngine::refineShift(stripOne, stripTwo, scale, shift, confidence)) {
+        return false;
+    }
+    AGOpenCVHelper::createShiftMatrix(transform, stripOffset.x + shift.x, stripOffset.y + shift.y);
+    return true;
+}
+
+const char *AGPyramidEngine::name() const
+{
+    return "pyramid";
+}
+
+#pragma mark -
+#pragma mark Refinement
+
+bool AGPyramidEngine::refineShift(const Mat &imageOne,
+                                  const Mat &imageTwo,
+                                  int searchRadius,
+                                  Point2d &shift,
+                                  double &confidence)
+{
+    confidence = 0.0;
+    if (imageOne.empty() || imageOne.size() != imageTwo.size() || imageOne.type() != imageTwo.type() || searchRadius < 1) {
+        return false;
+    }
+    Point estimatedShift(cvRound(shift.x), cvRound(shift.y));
+    // Template is moved away from borders, so every compared translation keeps it inside second image
+    int borderX = abs(estimatedShift.x) + searchRadius;
+    int borderY = abs(estimatedShift.y) + searchRadius;
+    Rect templateRegion(borderX, borderY, imageOne.cols - 2 * borderX, imageOne.rows - 2 * borderY);
+    if (templateRegion.width < PYRAMID_ENGINE_MINIMAL_TEMPLATE_SIZE
+        || templateRegion.height < PYRAMID_ENGINE_MINIMAL_TEMPLATE_SIZE) {
+        return false;
+    }
+    Rect searchRegion(templateRegion.x + estimatedShift.x - searchRadius,
+                      templateRegion.y + estimatedShift.y - searchRadius,
+                      templateRegion.width + 2 * searchRadius,
+                      templateRegion.height + 2 * searchRadius);
+    Mat scores;
+    matchTemplate(imageTwo(searchRegion), imageOne(templateRegion), scores, CV_TM_CCOEFF_NORMED);
+
+    double peakScore;
+    Point peak;
+    minMaxLoc(scores, nullptr, &peakScore, nullptr, &peak);
+    double offsetX = 0.0, offsetY = 0.0;
+    if (peak.x > 0 && peak.x < scores.cols - 1) {
+        offsetX = AGRegistrationEngine::parabolaVertexOffset(scores.at<float>(peak.y, peak.x - 1),
+                                                             peakScore,
+                                                             scores.at<float>(peak.y, peak.x + 1));
+    }
+    if (peak.y > 0 && peak.y < scores.rows - 1) {
+        offsetY = AGRegistrationEngine::parabolaVertexOffset(scores.at<float>(peak.y - 1, peak.x),
+                                                             peakScore,
+                                                             scores.at<float>(peak.y + 1, peak.x));
+    }
+    shift = Point2d(estimatedShift.x + peak.x - searchRadius + offsetX, estimatedShift.y + peak.y - searchRadius + offsetY);
+    confidence = min(max(peakScore, 0.0), 1.0);
+    return true;
+}
@@ -0,0 +1,56 @@
+//
+//  Created by Aleksander Grzyb on 21/09/15.
+//  Copyright (c) 2015 Aleksander Grzyb. All rights reserved.
+//
+
+#ifndef __Mosaic_Stitcher__AGPyramidEngine__
+#define __Mosaic_Stitcher__AGPyramidEngine__
+
+#include "AGRegistrationEngine.h"
+
+#include <stdio.h>
+#include <opencv2/opencv.hpp>
+
+ /// Registers overlap regions of tiles coarse to fine. Translation is estimated with phase correlation on strips
+ /// downsampled pyramidLevels times, then refined at full resolution with normalized cross correlation only within
+ /// a few pixels of the coarse estimate. Confidence is the correlation coefficient at the refined peak.
+
+class AGPyramidEngine : public AGRegistrationEngine {
+public:
+
+    /**
+     *  Constructor of AGPyramidEngine object.
+     *
+     *  @param parameters Loaded parameters from configuration file.
+     */
+    AGPyramidEngine(const AGParameters &parameters);
+
+    bool registerImages(const AGImage &imageOne,
+                        const AGImage &imageTwo,
+                        ImageDirection imageDirection,
+                        cv::Mat &transform,
+                        double &confidence) const;
+
+    const char *name() const;
+
+    /**
+     *  Refines translation between two images of the same size. Template cut from the middle of first image is
+     *  compared (normalized cross correlation) with second image only at translations within searchRadius of
+     *  estimated translation, peak is refined to sub-pixel precision with parabola fitted to its neighbours.
+     *
+     *  @param imageOne     First image (single channel, CV_32F).
+     *  @param imageTwo     Second image (single channel, CV_32F).
+     *  @param searchRadius Maximal distance (in pixels, in both axes) from estimated translation.
+     *  @param shift        Estimated translation (input) and refined translation (output).
+     *  @param confidence   Output correlation coefficient at the peak (from 0 to 1).
+     *
+     *  @return Indicates if template fits into images and translation was refined.
+     */
+    static bool refineShift(const cv::Mat &imageOne,
+                            const cv::Mat &imageTwo,
+                            int searchRadius,
+                            cv::Point2d &shift,
+                            double &confidence);
+};
+
+#endif /* defined(__Mosaic_Stitcher__AGPyramidEngine__) */
@@ -0,0 +1,148 @@
+//
+//  Created by Aleksander Grzyb on 21/09/15.
+//  Copyright (c) 2015 Aleksander Grzyb. All rights reserved.
+//
+
+#include "AGRegistrationEngine.h"
+#include "AGPhaseCorrelationEngine.h"
+#include "AGPyramidEngine.h"
+#include "AGSkeletonEngine.h"
+#include "AGOpenCVHelper.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace cv;
+using namespace std;
+
+#pragma mark -
+#pragma mark Creating Engine
+
+AGRegistrationEngine::AGRegistrationEngine(const AGParameters &parameters)
+{
+    this->parameters = parameters;
+}
+
+shared_ptr<AGRegistrationEngine> AGRegistrationEngine::createRegistrationEngine(const string &name,
+                                                                               const AGParameters &parameters,
+                                                                               AGError &error)
+{
+    if (name == "phaseCorrelation") {
+        return make_shared<AGPhaseCorrelationEngine>(parameters);
+    }
+    if (name == "pyramid") {
+        return make_shared<AGPyramidEngine>(parameters);
+    }
+    if (name == "skeleton") {
+        return make_shared<AGSkeletonEngine>(parameters);
+    }
+    error = { true, "createRegistrationEngine: unknown registration engine \"" + name + "\"." };
+    return nullptr;
+}
+
+#pragma mark -
+#pragma mark Consistency
+
+double AGRegistrationEngine::consistencyOfTransform(const Mat &imageOne,
+                                                    const Mat &imageTwo,
+                                                    const Rect &regionOne,
+                                                    const Mat &transform)
+{
+    if (!imageOne.data || !imageTwo.data || imageOne.depth() != CV_8U || imageTwo.type() != imageOne.type()
+        || transform.rows != 2 || transform.cols != 3 || (regionOne & Rect(Point(0, 0), imageOne.size())) != regionOne || regionOne.area() <= 0) {
+        return -1.0;
+    }
+    // Warp from region of first image to second image: w(q) = T(q + regionOne.tl)
+    Mat warp;
+    transform.convertTo(warp, CV_64F);
+    Mat regionOneOrigin = (Mat_<double>(2, 1) << regionOne.x, regionOne.y);
+    Mat(warp.col(2) + warp.colRange(0, 2) * regionOneOrigin).copyTo(warp.col(2));
+    Mat warpedImage;
+    warpAffine(imageTwo, warpedImage, warp, regionOne.size(), INTER_LINEAR | WARP_INVERSE_MAP);
+    Mat regionOfImageOne = imageOne(regionOne);
+    if (warpedImage.channels() > 1) {
+        extractChannel(warpedImage, warpedImage, 0);
+        extractChannel(regionOfImageOne, regionOfImageOne, 0);
+    }
+
+    const double *w = warp.ptr<double>();
+    double maximalX = imageTwo.cols - 1, maximalY = imageTwo.rows - 1;
+    double sumOne = 0.0, sumTwo = 0.0, sumOneSquared = 0.0, sumTwoSquared = 0.0, sumProduct = 0.0;
+    long count = 0;
+    for (int y = 0; y < regionOne.height; ++y) {
+        const uchar *rowOne = regionOfImageOne.ptr<uchar>(y);
+        const uchar *rowTwo = warpedImage.ptr<uchar>(y);
+        for (int x = 0; x < regionOne.width; ++x) {
+            double mappedX = w[0] * x + w[1] * y + w[2];
+            double mappedY = w[3] * x + w[4] * y + w[5];
+            if (mappedX < 0.0 || mappedY < 0.0 || mappedX > maximalX || mappedY > maximalY) {
+                continue;
+            }
+            double valueOne = rowOne[x], valueTwo = rowTwo[x];
+            sumOne += valueOne;
+            sumTwo += valueTwo;
+            sumOneSquared += valueOne * valueOne;
+            sumTwoSquared += valueTwo * valueTwo;
+            sumProduct += valueOne * valueTwo;
+            count++;
+        }
+    }
+    if (count * 4 < regionOne.area()) {
+        return -1.0;
+    }
+    double covariance = count * sumProduct - sumOne * sumTwo;
+    double variance = (count * sumOneSquared - sumOne * sumOne) * (count * sumTwoSquared - sumTwo * sumTwo);
+    if (variance <= 0.0) {
+        return -1.0;
+    }
+    return covariance / sqrt(variance);
+}
+
+#pragma mark -
+#pragma mark Overlap Regions
+
+bool AGRegistrationEngine::extractOverlapStrips(const AGImage &imageOne,
+                                                const AGImage &imageTwo,
+                                                ImageDirection imageDirection,
+                                                Mat &stripOne,
+                                                Mat &stripTwo,
+                                                Point2d &stripOffset) const
+{
+    if (!imageOne.image.data || !imageTwo.image.data || imageOne.image.size() != imageTwo.image.size()) {
+        return false;
+    }
+    Rect regionOne = AGOpenCVHelper::overlapRegionOfImage(imageOne.image.size(),
+                                                          imageDirection,
+                                                          this->parameters.percentOverlap);
+    Rect regionTwo = AGOpenCVHelper::overlapRegionOfImage(imageTwo.image.size(),
+                                                          AGOpenCVHelper::oppositeDirection(imageDirection),
+                                                          this->parameters.percentOverlap);
+    if (regionOne.area() <= 0 || regionOne.size() != regionTwo.size()) {
+        return false;
+    }
+
+    Mat grayscaleOne = imageOne.image(regionOne), grayscaleTwo = imageTwo.image(regionTwo);
+    if (grayscaleOne.channels() > 1) {
+        extractChannel(grayscaleOne, grayscaleOne, 0);
+        extractChannel(grayscaleTwo, grayscaleTwo, 0);
+    }
+    grayscaleOne.convertTo(stripOne, CV_32F);
+    grayscaleTwo.convertTo(stripTwo, CV_32F);
+    stripOffset = Point2d(regionTwo.x - regionOne.x, regionTwo.y - regionOne.y);
+    return true;
+}
+
+Size AGRegistrationEngine::maximalShiftOfImage(const AGImage &imageOne) const
+{
+    double shiftParameter = min(max(this->parameters.shiftParameter, 0.0), 1.0);
+    return Size(max((int)(imageOne.image.cols * shiftParameter), 1), max((int)(imageOne.image.rows * shiftParameter), 1));
+}
+
+double AGRegistrationEngine::parabolaVertexOffset(double previous, double peak, double next)
+{
+    double denominator = previous - 2.0 * peak + next;
+    if (denominator >= 0.0) {
+        return 0.0;
+    }
+    return min(max(0.5 * (previous - next) / denominator, -0.5), 0.5);
+}
@@ -0,0 +1,132 @@
+//
+//  Created by Aleksander Grzyb on 21/09/15.
+//  Copyright (c) 2015 Aleksander Grzyb. All rights reserved.
+//
+
+#ifndef __Mosaic_Stitcher__AGRegistrationEngine__
+#define __Mosaic_Stitcher__AGRegistrationEngine__
+
+#include "AGDataStructures.h"
+
+#include <stdio.h>
+#include <memory>
+#include <string>
+#include <opencv2/opencv.hpp>
+
+ /// Interface of engines that register pair of neighbouring tiles directly from pixels of their overlap regions
+ /// (without features). Engines keep only parameters, so one engine can be used by many threads at the same time.
+
+class AGRegistrationEngine {
+public:
+
+    /**
+     *  Constructor of AGRegistrationEngine object.
+     *
+     *  @param parameters Loaded parameters from configuration file.
+     */
+    AGRegistrationEngine(const AGParameters &parameters);
+
+    virtual ~AGRegistrationEngine() {}
+
+    /**
+     *  Creates engine with given name.
+     *
+     *  @param name       Name of engine ("phaseCorrelation", "pyramid" or "skeleton").
+     *  @param parameters Loaded parameters from configuration file.
+     *  @param error      Return error.
+     *
+     *  @return Engine (nullptr when name is not known).
+     */
+    static std::shared_ptr<AGRegistrationEngine> createRegistrationEngine(const std::string &name,
+                                                                          const AGParameters &parameters,
+                                                                          AGError &error);
+
+    /**
+     *  Finds transformation between two tiles (first one is transformed) in coordinates of tiles.
+     *
+     *  @param imageOne       First image.
+     *  @param imageTwo       Second image.
+     *  @param imageDirection Stitching direction (see ImageDirection enum in AGDataStructures.h).
+     *  @param transform      Output transformation matrix (2x3, CV_64F).
+     *  @param confidence     Output confidence of found transformation (from 0 to 1).
+     *
+     *  @return Indicates if transformation matrix was found.
+     */
+    virtual bool registerImages(const AGImage &imageOne,
+                                const AGImage &imageTwo,
+                                ImageDirection imageDirection,
+                                cv::Mat &transform,
+                                double &confidence) const = 0;
+
+    /**
+     *  Returns name of engine (used as name of stage and counters in the run report).
+     *
+     *  @return Name of engine.
+     */
+    virtual const char *name() const = 0;
+
+    /**
+     *  Calculates consistency of transform: correlation coefficient of region of first image and pixels of second
+     *  image at positions given by transform (quick check of transforms found by any method).
+     *
+     *  @param imageOne  First image.
+     *  @param imageTwo  Second image.
+     *  @param regionOne Region of first image (overlap region).
+     *  @param transform Transformation matrix between images in coordinates of images.
+     *
+     *  @return Correlation coefficient (-1 when less than quarter of region lies inside second image).
+     */
+    static double consistencyOfTransform(const cv::Mat &imageOne,
+                                         const cv::Mat &imageTwo,
+                                         const cv::Rect &regionOne,
+                                         const cv::Mat &transform);
+
+protected:
+
+    /**
+     *  Cuts overlap regions of both tiles and converts them to single channel float images. Pixel at point p of
+     *  first strip lies at point p + stripOffset of second tile when tiles are placed as predicted by percentOverlap.
+     *
+     *  @param imageOne       First image.
+     *  @param imageTwo       Second image.
+     *  @param imageDirection Stitching direction (see ImageDirection enum in AGDataStructures.h).
+     *  @param stripOne       Output overlap region of first image.
+     *  @param stripTwo       Output overlap region of second image.
+     *  @param stripOffset    Output offset between strips in coordinates of tiles.
+     *
+     *  @return Indicates if strips are not empty and have the same size.
+     */
+    bool extractOverlapStrips(const AGImage &imageOne,
+                              const AGImage &imageTwo,
+                              ImageDirection imageDirection,
+                              cv::Mat &stripOne,
+                              cv::Mat &stripTwo,
+                              cv::Point2d &stripOffset) const;
+
+    /**
+     *  Returns maximal displacement between strips (shiftParameter of tile size) that engine searches for.
+     *
+     *  @param imageOne First image.
+     *
+     *  @return Maximal displacement in x and y axis.
+     */
+    cv::Size maximalShiftOfImage(const AGImage &imageOne) const;
+
+    /**
+     *  Returns offset of parabola vertex fitted to three values (from -0.5 to 0.5).
+     *
+     *  @param previous Value before the peak.
+     *  @param peak     Value of the peak.
+     *  @param next     Value after the peak.
+     *
+     *  @return Offset of vertex from the peak.
+     */
+    static double parabolaVertexOffset(double previous, double peak, double next);
+
+    /**
+     *  Loaded parameters from configuration file.
+     */
+    AGParameters parameters;
+};
+
+#endif /* defined(__Mosaic_Stitcher__AGRegistrationEngine__) */
@@ -0,0 +1,223 @@
+//
+//  Created by Aleksander Grzyb on 21/09/15.
+//  Copyright (c) 2015 Aleksander Grzyb. All rights reserved.
+//
+
+#include "AGRobustEstimator.h"
+
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+
+using namespace cv;
+using namespace std;
+
+/**
+ *  Seed of random generator, every estimation starts with the same seed so results do not depend on threads.
+ */
+static const uint64 ROBUST_ESTIMATOR_SEED = 0x12345678;
+
+#pragma mark -
+#pragma mark Estimation
+
+bool AGRobustEstimator::estimateTransform(const Point2f *pointsOne,
+                                          const Point2f *pointsTwo,
+                                          const float *distances,
+                                          int count,
+                                          AGTransformModel model,
+                                          Mat &transform,
+                                          vector<uchar> &inliers,
+                                          int &numberOfIterations)
+{
+    numberOfIterations = 0;
+    int sampleSize = AGRobustEstimator::minimalSampleSize(model);
+    if (count < sampleSize) {
+        return false;
+    }
+
+    // Correspondences sorted by quality, the best ones are sampled first
+    static thread_local vector<int> order;
+    static thread_local vector<uchar> candidateInliers;
+    static thread_local vector<int> inlierIndices;
+    order.resize(count);
+    candidateInliers.resize(count);
+    inlierIndices.resize(count);
+    for (int i = 0; i < count; ++i) {
+        order[i] = i;
+    }
+    sort(order.begin(), order.end(), [&](int first, int second) {
+        return distances[first] < distances[second] || (distances[first] == distances[second] && first < second);
+    });
+
+    // PROSAC growth function: after prosacLimit samples the pool is extended by the next correspondence
+    double averageSamplesOfPool = ROBUST_ESTIMATOR_MAXIMAL_ITERATIONS;
+    for (int i = 0; i < sampleSize; ++i) {
+        averageSamplesOfPool *= (double)(sampleSize - i) / (count - i);
+    }
+    int poolSize = sampleSize;
+    double prosacLimit = 1.0;
+
+    RNG rng(ROBUST_ESTIMATOR_SEED);
+    double bestTransform[6] = { 0.0 };
+    int bestNumberOfInliers = 0;
+    int requiredIterations = ROBUST_ESTIMATOR_MAXIMAL_ITERATIONS;
+    int sample[3];
+    for (int iteration = 1; iteration <= requiredIterations; ++iteration) {
+        numberOfIterations = iteration;
+        if (iteration > prosacLimit && poolSize < count) {
+            double nextAverage = averageSamplesOfPool * (poolSize + 1) / (poolSize + 1 - sampleSize);
+            prosacLimit += ceil(nextAverage - averageSamplesOfPool);
+            averageSamplesOfPool = nextAverage;
+            poolSize++;
+        }
+        // The newest correspondence of the pool is always in the sample until the pool grows
+        int numberOfRandomElements = sampleSize;
+        if (prosacLimit >= iteration && poolSize > sampleSize) {
+            sample[--numberOfRandomElements] = order[poolSize - 1];
+        }
+        int randomPoolSize = numberOfRandomElements < sampleSize ? poolSize - 1 : poolSize;
+        for (int i = 0; i < numberOfRandomElements; ++i) {
+            bool isRepeated = true;
+            while (isRepeated) {
+                sample[i] = order[rng.uniform(0, randomPoolSize)];
+                isRepeated = false;
+                for (int j = 0; j < i; ++j) {
+                    isRepeated = isRepeated || sample[j] == sample[i];
+                }
+            }
+        }
+
+        double candidateTransform[6];
+        if (!AGRobustEstimator::fitTransformToCorrespondences(pointsOne, pointsTwo, sample, sampleSize, model, candidateTransform)) {
+            continue;
+        }
+        int numberOfInliers = AGRobustEstimator::findInliers(pointsOne, pointsTwo, count, candidateTransform, nullptr);
+        if (numberOfInliers <= bestNumberOfInliers) {
+            continue;
+        }
+        bestNumberOfInliers = numberOfInliers;
+        copy(candidateTransform, candidateTransform + 6, bestTransform);
+
+        // Adaptive termination: enough samples to draw all-inlier sample with required confidence
+        double inlierRatio = (double)numberOfInliers / count;
+        double allInliersProbability = pow(inlierRatio, sampleSize);
+        if (allInliersProbability >= 1.0) {
+            break;
+        }
+        double neededIterations = log(1.0 - ROBUST_ESTIMATOR_CONFIDENCE) / log(1.0 - allInliersProbability);
+        requiredIterations = (int)min((double)requiredIterations, ceil(neededIterations));
+    }
+    if (bestNumberOfInliers < sampleSize) {
+        return false;
+    }
+
+    // Refitting the best model to all its inliers
+    AGRobustEstimator::findInliers(pointsOne, pointsTwo, count, bestTransform, candidateInliers.data());
+    int numberOfInliers = 0;
+    for (int i = 0; i < count; ++i) {
+        if (candidateInliers[i]) {
+            inlierIndices[numberOfInliers++] = i;
+        }
+    }
+    double refinedTransform[6];
+    if (AGRobustEstimator::fitTransformToCorrespondences(pointsOne, pointsTwo, inlierIndices.data(), numberOfInliers, model, refinedTransform)
+        && AGRobustEstimator::findInliers(pointsOne, pointsTwo, count, refinedTransform, nullptr) >= numberOfInliers) {
+        copy(refinedTransform, refinedTransform + 6, bestTransform);
+    }
+
+    inliers.resize(count);
+    AGRobustEstimator::findInliers(pointsOne, pointsTwo, count, bestTransform, inliers.data());
+    transform = (Mat_<double>(2, 3) << bestTransform[0], bestTransform[1], bestTransform[2],
+                                       bestTransform[3], bestTransform[4], bestTransform[5]);
+    return true;
+}
+
+bool AGRobustEstimator::fitTransform(const Point2f *pointsOne,
+                                     const Point2f *pointsTwo,
+                                     int count,
+                                     AGTransformModel model,
+                                     Mat &transform)
+{
+    if (count < AGRobustEstimator::minimalSampleSize(model)) {
+        return false;
+    }
+    vector<int> indices(count);
+    for (int i = 0; i < count; ++i) {
+        indices[i] = i;
+    }
+    double coefficients[6];
+    if (!AGRobustEstimator::fitTransformToCorrespondences(pointsOne, pointsTwo, indices.data(), count, model, coefficients)) {
+        return false;
+    }
+    transform = (Mat_<double>(2, 3) << coefficients[0], coefficients[1], coefficients[2],
+                                       coefficients[3], coefficients[4], coefficients[5]);
+    return true;
+}
+
+int AGRobustEstimator::minimalSampleSize(AGTransformModel model)
+{
+    return model == TranslationModel ? 1 : 2;
+}
+
+#pragma mark -
+#pragma mark Fitting Models
+
+bool AGRobustEstimator::fitTransformToCorrespondences(const Point2f *pointsOne,
+                                                      const Point2f *pointsTwo,
+                                                      const int *indices,
+                                                      int count,
+                                                      AGTransformModel model,
+                                                      double *transform)
+{
+    double centroidOneX = 0.0, centroidOneY = 0.0, centroidTwoX = 0.0, centroidTwoY = 0.0;
+    for (int i = 0; i < count; ++i) {
+        centroidOneX += pointsOne[indices[i]].x;
+        centroidOneY += pointsOne[indices[i]].y;
+        centroidTwoX += pointsTwo[indices[i]].x;
+        centroidTwoY += pointsTwo[indices[i]].y;
+    }
+    centroidOneX /= count; centroidOneY /= count; centroidTwoX /= count; centroidTwoY /= count;
+
+    double cosine = 1.0, sine = 0.0;
+    if (model != TranslationModel) {
+        // Closed form least squares (Procrustes) on centred points
+        double dotSum = 0.0, crossSum = 0.0, squaredNormSum = 0.0;
+        for (int i = 0; i < count; ++i) {
+            double xOne = pointsOne[indices[i]].x - centroidOneX, yOne = pointsOne[indices[i]].y - centroidOneY;
+            double xTwo = pointsTwo[indices[i]].x - centroidTwoX, yTwo = pointsTwo[indices[i]].y - centroidTwoY;
+            dotSum += xOne * xTwo + yOne * yTwo;
+            crossSum += xOne * yTwo - yOne * xTwo;
+            squaredNormSum += xOne * xOne + yOne * yOne;
+        }
+        double norm = sqrt(dotSum * dotSum + crossSum * crossSum);
+        if (squaredNormSum < FLT_EPSILON || norm < FLT_EPSILON) {
+            return false;
+        }
+        double scale = model == SimilarityModel ? norm / squaredNormSum : 1.0;
+        cosine = scale * dotSum / norm;
+        sine = scale * crossSum / norm;
+    }
+    transform[0] = cosine; transform[1] = -sine; transform[2] = centroidTwoX - (cosine * centroidOneX - sine * centroidOneY);
+    transform[3] = sine; transform[4] = cosine; transform[5] = centroidTwoY - (sine * centroidOneX + cosine * centroidOneY);
+    return true;
+}
+
+int AGRobustEstimator::findInliers(const Point2f *pointsOne,
+                                   const Point2f *pointsTwo,
+                                   int count,
+                                   const double *transform,
+                                   uchar *inliers)
+{
+    double squaredThreshold = ROBUST_ESTIMATOR_THRESHOLD * ROBUST_ESTIMATOR_THRESHOLD;
+    int numberOfInliers = 0;
+    for (int i = 0; i < count; ++i) {
+        double x = transform[0] * pointsOne[i].x + transform[1] * pointsOne[i].y + transform[2] - pointsTwo[i].x;
+        double y = transform[3] * pointsOne[i].x + transform[4] * pointsOne[i].y + transform[5] - pointsTwo[i].y;
+        bool isInlier = x * x + y * y <= squaredThreshold;
+        if (inliers) {
+            inliers[i] = isInlier ? 1 : 0;
+        }
+        numberOfInliers += isInlier;
+    }
+    return numberOfInliers;
+}
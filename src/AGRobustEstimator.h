@@ -0,0 +1,111 @@
+//
+//  Created by Aleksander Grzyb on 21/09/15.
+//  Copyright (c) 2015 Aleksander Grzyb. All rights reserved.
+//
+
+#ifndef __Mosaic_Stitcher__AGRobustEstimator__
+#define __Mosaic_Stitcher__AGRobustEstimator__
+
+#include "AGDataStructures.h"
+
+#include <stdio.h>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+ /// Robust estimation of transform between two sets of points. Samples are drawn from correspondences sorted by
+ /// quality (PROSAC: the pool of sampled correspondences grows from the best ones), sampling stops as soon as
+ /// probability of missing better model drops below 1 - ROBUST_ESTIMATOR_CONFIDENCE, and the best model is refitted
+ /// with least squares to all its inliers.
+
+class AGRobustEstimator {
+public:
+    
+    /**
+     *  Estimates transform that maps points of first set onto points of second set.
+     *
+     *  @param pointsOne          Points of first set.
+     *  @param pointsTwo          Corresponding points of second set.
+     *  @param distances          Distances of descriptors of correspondences (smaller is better, used for ordering).
+     *  @param count              Number of correspondences.
+     *  @param model              Model of transform.
+     *  @param transform          Output transform (2x3, CV_64F).
+     *  @param inliers            Output mask of inliers (non zero for inlier, one value per correspondence).
+     *  @param numberOfIterations Output number of drawn samples.
+     *
+     *  @return False when transform could not be estimated (too few or degenerate correspondences).
+     */
+    static bool estimateTransform(const cv::Point2f *pointsOne,
+                                  const cv::Point2f *pointsTwo,
+                                  const float *distances,
+                                  int count,
+                                  AGTransformModel model,
+                                  cv::Mat &transform,
+                                  std::vector<uchar> &inliers,
+                                  int &numberOfIterations);
+    
+    /**
+     *  Fits transform to all correspondences with least squares (no outliers rejection).
+     *
+     *  @param pointsOne Points of first set.
+     *  @param pointsTwo Corresponding points of second set.
+     *  @param count     Number of correspondences.
+     *  @param model     Model of transform.
+     *  @param transform Output transform (2x3, CV_64F).
+     *
+     *  @return False when transform could not be fitted.
+     */
+    static bool fitTransform(const cv::Point2f *pointsOne,
+                             const cv::Point2f *pointsTwo,
+                             int count,
+                             AGTransformModel model,
+                             cv::Mat &transform);
+    
+    /**
+     *  Returns number of correspondences needed to fit model.
+     *
+     *  @param model Model of transform.
+     *
+     *  @return Size of minimal sample.
+     */
+    static int minimalSampleSize(AGTransformModel model);
+    
+private:
+    
+    /**
+     *  Fits transform to selected correspondences with least squares (closed form for all models).
+     *
+     *  @param pointsOne Points of first set.
+     *  @param pointsTwo Corresponding points of second set.
+     *  @param indices   Indices of selected correspondences.
+     *  @param count     Number of selected correspondences.
+     *  @param model     Model of transform.
+     *  @param transform Output coefficients of 2x3 transform (row major).
+     *
+     *  @return False when selected points are degenerate.
+     */
+    static bool fitTransformToCorrespondences(const cv::Point2f *pointsOne,
+                                              const cv::Point2f *pointsTwo,
+                                              const int *indices,
+                                              int count,
+                                              AGTransformModel model,
+                                              double *transform);
+    
+    /**
+     *  Marks correspondences that transform maps within ROBUST_ESTIMATOR_THRESHOLD.
+     *
+     *  @param pointsOne Points of first set.
+     *  @param pointsTwo Corresponding points of second set.
+     *  @param count     Number of correspondences.
+     *  @param transform Coefficients of 2x3 transform.
+     *  @param inliers   Output mask of inliers (can be nullptr when only number is needed).
+     *
+     *  @return Number of inliers.
+     */
+    static int findInliers(const cv::Point2f *pointsOne,
+                           const cv::Point2f *pointsTwo,
+                           int count,
+                           const double *transform,
+                           uchar *inliers);
+};
+
+#endif /* defined(__Mosaic_Stitcher__AGRobustEstimator__) */
@@ -0,0 +1,110 @@
+//
+//  Created by Aleksander Grzyb on 21/09/15.
+//  Copyright (c) 2015 Aleksander Grzyb. All rights reserved.
+//
+
+#include "AGRunReport.h"
+
+#include <time.h>
+#include <fstream>
+#include <sstream>
+
+using namespace cv;
+using namespace std;
+
+#pragma mark -
+#pragma mark Initialization
+
+AGRunReport::AGRunReport(const string &name)
+{
+    this->name = name;
+}
+
+#pragma mark -
+#pragma mark Collecting
+
+void AGRunReport::addStageTime(const string &stage, double wallTime, double cpuTime)
+{
+    lock_guard<std::mutex> lock(this->mutex);
+    AGStageTime &stageTime = this->stages[stage];
+    stageTime.numberOfCalls++;
+    stageTime.wallTime += wallTime;
+    stageTime.cpuTime += cpuTime;
+}
+
+void AGRunReport::increaseCounter(const string &counter, long value)
+{
+    lock_guard<std::mutex> lock(this->mutex);
+    this->counters[counter] += value;
+}
+
+double AGRunReport::threadCPUTime()
+{
+    timespec time;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time) != 0) {
+        return 0.0;
+    }
+    return time.tv_sec + time.tv_nsec * 1e-9;
+}
+
+#pragma mark -
+#pragma mark Saving
+
+string AGRunReport::description()
+{
+    lock_guard<std::mutex> lock(this->mutex);
+    stringstream json;
+    json << "{" << endl;
+    json << "  \"name\": \"" << this->name << "\"," << endl;
+    json << "  \"stages\": {";
+    for (auto iterator = this->stages.begin(); iterator != this->stages.end(); ++iterator) {
+        json << (iterator == this->stages.begin() ? "" : ",") << endl;
+        json << "    \"" << iterator->first << "\": { "
+             << "\"calls\": " << iterator->second.numberOfCalls << ", "
+             << "\"wallTime\": " << iterator->second.wallTime << ", "
+             << "\"cpuTime\": " << iterator->second.cpuTime << " }";
+    }
+    json << endl << "  }," << endl;
+    json << "  \"counters\": {";
+    for (auto iterator = this->counters.begin(); iterator != this->counters.end(); ++iterator) {
+        json << (iterator == this->counters.begin() ? "" : ",") << endl;
+        json << "    \"" << iterator->first << "\": " << iterator->second;
+    }
+    json << endl << "  }" << endl;
+    json << "}" << endl;
+    return json.str();
+}
+
+void AGRunReport::saveToFile(const string &savePath, AGError &error)
+{
+    if (savePath.empty()) {
+        error = { true, "saveToFile: savePath is empty." }; return;
+    }
+    ofstream file(savePath + "/" + this->name + "_report.json");
+    if (!file.is_open()) {
+        error = { true, "saveToFile: Couldn't open report file." }; return;
+    }
+    file << this->description();
+}
+
+#pragma mark -
+#pragma mark Stage Timer
+
+AGStageTimer::AGStageTimer(AGRunReport *report, const char *stage)
+{
+    this->report = report;
+    this->stage = stage;
+    if (this->report) {
+        this->startTick = getTickCount();
+        this->startCPUTime = AGRunReport::threadCPUTime();
+    }
+}
+
+AGStageTimer::~AGStageTimer()
+{
+    if (this->report) {
+        double wallTime = (getTickCount() - this->startTick) / getTickFrequency();
+        double cpuTime = AGRunReport::threadCPUTime() - this->startCPUTime;
+        this->report->addStageTime(this->stage, wallTime, cpuTime);
+    }
+}
@@ -0,0 +1,153 @@
+//
+//  Created by Aleksander Grzyb on 21/09/15.
+//  Copyright (c) 2015 Aleksander Grzyb. All rights reserved.
+//
+
+#ifndef __Mosaic_Stitcher__AGRunReport__
+#define __Mosaic_Stitcher__AGRunReport__
+
+#include "AGDataStructures.h"
+
+#include <stdio.h>
+#include <string>
+#include <map>
+#include <mutex>
+
+ /// Accumulated time of one stage.
+
+struct AGStageTime {
+    
+    /**
+     *  Number of measured executions of the stage.
+     */
+    long numberOfCalls;
+    
+    /**
+     *  Sum of wall times (seconds).
+     */
+    double wallTime;
+    
+    /**
+     *  Sum of CPU times of executing threads (seconds).
+     */
+    double cpuTime;
+};
+
+ /// Collects times of stages and counters of one run (one mosaic) and saves them as JSON report. Safe to use from
+ /// multiple threads.
+
+class AGRunReport {
+public:
+    
+    /**
+     *  Constructor of AGRunReport object.
+     *
+     *  @param name Name of the report (used as name of the file).
+     */
+    AGRunReport(const std::string &name);
+    
+    /**
+     *  Adds time of one execution of the stage.
+     *
+     *  @param stage    Name of the stage.
+     *  @param wallTime Wall time (seconds).
+     *  @param cpuTime  CPU time of executing thread (seconds).
+     */
+    void addStageTime(const std::string &stage, double wallTime, double cpuTime);
+    
+    /**
+     *  Increases counter by given value.
+     *
+     *  @param counter Name of the counter.
+     *  @param value   Value to add.
+     */
+    void increaseCounter(const std::string &counter, long value = 1);
+    
+    /**
+     *  Returns report in JSON format.
+     *
+     *  @return JSON description of report.
+     */
+    std::string description();
+    
+    /**
+     *  Saves report to disc as [name]_report.json file.
+     *
+     *  @param savePath Path to save.
+     *  @param error    Error.
+     */
+    void saveToFile(const std::string &savePath, AGError &error);
+    
+    /**
+     *  Returns CPU time used by the calling thread.
+     *
+     *  @return CPU time (seconds).
+     */
+    static double threadCPUTime();
+    
+private:
+    
+    /**
+     *  Name of the report.
+     */
+    std::string name;
+    
+    /**
+     *  Times of stages.
+     */
+    std::map<std::string, AGStageTime> stages;
+    
+    /**
+     *  Counters.
+     */
+    std::map<std::string, long> counters;
+    
+    /**
+     *  Guards stages and counters.
+     */
+    std::mutex mutex;
+};
+
+ /// Measures wall and CPU time from its construction to its destruction and adds it to the report as one execution
+ /// of the stage. Does nothing when report is nullptr.
+
+class AGStageTimer {
+public:
+    
+    /**
+     *  Constructor of AGStageTimer object. Starts measurement.
+     *
+     *  @param report Report to which time is added (can be nullptr).
+     *  @param stage  Name of the stage.
+     */
+    AGStageTimer(AGRunReport *report, const char *stage);
+    
+    /**
+     *  Stops measurement and adds time to the report.
+     */
+    ~AGStageTimer();
+    
+private:
+    
+    /**
+     *  Report to which time is added.
+     */
+    AGRunReport *report;
+    
+    /**
+     *  Name of the stage.
+     */
+    const char *stage;
+    
+    /**
+     *  Tick count at the start of measurement.
+     */
+    int64 startTick;
+    
+    /**
+     *  CPU time of thread at the start of measurement.
+     */
+    double startCPUTime;
+};
+
+#endif /* defined(__Mosaic_Stitcher__AGRunReport__) */
@@ -0,0 +1,214 @@
+//
+//  Created by Aleksander Grzyb on 21/09/15.
+//  Copyright (c) 2015 Aleksander Grzyb. All rights reserved.
+//
+
+#include "AGSkeletonEngine.h"
+#include "AGOpenCVHelper.h"
+#include "AGRobustEstimator.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace cv;
+using namespace std;
+
+AGSkeletonEngine::AGSkeletonEngine(const AGParameters &parameters) : AGRegistrationEngine(parameters)
+{
+}
+
+#pragma mark -
+#pragma mark Registration
+
+bool AGSkeletonEngine::registerImages(const AGImage &imageOne,
+                                      const AGImage &imageTwo,
+                                      ImageDirection imageDirection,
+                                      Mat &transform,
+                                      double &confidence) const
+{
+    confidence = 0.0;
+    if (imageOne.skeleton.empty() || imageOne.skeleton.size() != imageTwo.skeleton.size()) {
+        return false;
+    }
+    Size tileSize = imageOne.skeleton.size();
+    Rect regionOne = AGOpenCVHelper::overlapRegionOfImage(tileSize, imageDirection, this->parameters.percentOverlap);
+    Rect regionTwo = AGOpenCVHelper::overlapRegionOfImage(tileSize,
+                                                          AGOpenCVHelper::oppositeDirection(imageDirection),
+                                                          this->parameters.percentOverlap);
+    Point2f stripOffset(regionTwo.x - regionOne.x, regionTwo.y - regionOne.y);
+    vector<Point2f> pointsOne;
+    this->skeletonPointsInRegion(imageOne.skeleton, regionOne, pointsOne);
+    if (pointsOne.size() < SKELETON_ENGINE_MINIMAL_POINTS) {
+        return false;
+    }
+
+    // Distance field covers every position of overlap region of the first tile that can be searched
+    Size maximalShift = this->maximalShiftOfImage(imageOne);
+    int margin = SKELETON_ENGINE_TRUNCATION_DISTANCE;
+    Rect searchRegion(regionTwo.x - maximalShift.width - margin,
+                      regionTwo.y - maximalShift.height - margin,
+                      regionTwo.width + 2 * (maximalShift.width + margin),
+                      regionTwo.height + 2 * (maximalShift.height + margin));
+    searchRegion &= Rect(Point(0, 0), tileSize);
+    Mat background;
+    compare(imageTwo.skeleton(searchRegion), 0, background, CMP_EQ);
+    int numberOfSkeletonPixels = (int)background.total() - countNonZero(background);
+    if (numberOfSkeletonPixels < SKELETON_ENGINE_MINIMAL_POINTS) {
+        return false;
+    }
+    Mat distances, labels;
+    distanceTransform(background, distances, labels, CV_DIST_L2, 5, DIST_LABEL_PIXEL);
+    // Every skeleton pixel has its own label, nearest skeleton pixel of any position is read through its label
+    vector<Point2f> pixelOfLabel(numberOfSkeletonPixels + 1);
+    int numberOfLabels = (int)pixelOfLabel.size();
+    for (int y = 0; y < background.rows; ++y) {
+        const uchar *backgroundRow = background.ptr<uchar>(y);
+        const int *labelsRow = labels.ptr<int>(y);
+        for (int x = 0; x < background.cols; ++x) {
+            if (!backgroundRow[x] && labelsRow[x] > 0 && labelsRow[x] < numberOfLabels) {
+                pixelOfLabel[labelsRow[x]] = Point2f(x + searchRegion.x, y + searchRegion.y);
+            }
+        }
+    }
+
+    Point2f shift = this->findShiftWithChamferSearch(pointsOne, distances, searchRegion.tl(), stripOffset, maximalShift);
+    Mat currentTransform;
+    AGOpenCVHelper::createShiftMatrix(currentTransform, shift.x, shift.y);
+
+    AGTransformModel model = this->transformModel();
+    vector<Point2f> transformedPoints, matchedPointsOne, matchedPointsTwo;
+    float maximalSquaredDistance = SKELETON_ENGINE_CORRESPONDENCE_DISTANCE * SKELETON_ENGINE_CORRESPONDENCE_DISTANCE;
+    for (int iteration = 0; iteration < SKELETON_ENGINE_ICP_ITERATIONS; ++iteration) {
+        cv::transform(pointsOne, transformedPoints, currentTransform);
+        matchedPointsOne.clear();
+        matchedPointsTwo.clear();
+        for (int i = 0; i < (int)transformedPoints.size(); ++i) {
+            Point position(cvRound(transformedPoints[i].x) - searchRegion.x, cvRound(transformedPoints[i].y) - searchRegion.y);
+            if (position.x < 0 || position.y < 0 || position.x >= labels.cols || position.y >= labels.rows) {
+                continue;
+            }
+            int label = labels.at<int>(position);
+            if (label <= 0 || label >= numberOfLabels) {
+                continue;
+            }
+            Point2f difference = pixelOfLabel[label] - transformedPoints[i];
+            if (difference.dot(difference) <= maximalSquaredDistance) {
+                matchedPointsOne.push_back(pointsOne[i]);
+                matchedPointsTwo.push_back(pixelOfLabel[label]);
+            }
+        }
+        if (matchedPointsOne.size() < SKELETON_ENGINE_MINIMAL_POINTS) {
+            return false;
+        }
+        Mat nextTransform;
+        if (!AGRobustEstimator::fitTransform(matchedPointsOne.data(),
+                                             matchedPointsTwo.data(),
+                                             (int)matchedPointsOne.size(),
+                                             model,
+                                             nextTransform)) {
+            return false;
+        }
+        double change = norm(nextTransform, currentTransform, NORM_INF);
+        currentTransform = nextTransform;
+        if (change < SKELETON_ENGINE_ICP_EPSILON) {
+            break;
+        }
+    }
+
+    cv::transform(pointsOne, transformedPoints, currentTransform);
+    int numberOfInliers = 0;
+    for (int i = 0; i < (int)transformedPoints.size(); ++i) {
+        Point position(cvRound(transformedPoints[i].x) - searchRegion.x, cvRound(transformedPoints[i].y) - searchRegion.y);
+        if (position.x >= 0 && position.y >= 0 && position.x < distances.cols && position.y < distances.rows
+            && distances.at<float>(position) <= SKELETON_ENGINE_INLIER_DISTANCE) {
+            numberOfInliers++;
+        }
+    }
+    confidence = (double)numberOfInliers / pointsOne.size();
+    transform = currentTransform;
+    return true;
+}
+
+const char *AGSkeletonEngine::name() const
+{
+    return "skeleton";
+}
+
+#pragma mark -
+#pragma mark Helpers
+
+void AGSkeletonEngine::skeletonPointsInRegion(const Mat &skeleton, const Rect &region, vector<Point2f> &points) const
+{
+    points.clear();
+    Rect clippedRegion = region & Rect(Point(0, 0), skeleton.size());
+    for (int y = clippedRegion.y; y < clippedRegion.y + clippedRegion.height; ++y) {
+        const uchar *skeletonRow = skeleton.ptr<uchar>(y);
+        for (int x = clippedRegion.x; x < clippedRegion.x + clippedRegion.width; ++x) {
+            if (skeletonRow[x]) {
+                points.push_back(Point2f(x, y));
+            }
+        }
+    }
+    if (points.size() > SKELETON_ENGINE_MAXIMAL_POINTS) {
+        double step = (double)points.size() / SKELETON_ENGINE_MAXIMAL_POINTS;
+        for (int i = 0; i < SKELETON_ENGINE_MAXIMAL_POINTS; ++i) {
+            points[i] = points[(int)(i * step)];
+        }
+        points.resize(SKELETON_ENGINE_MAXIMAL_POINTS);
+    }
+}
+
+Point2f AGSkeletonEngine::findShiftWithChamferSearch(const vector<Point2f> &points,
+                                                     const Mat &distances,
+                                                     const Point &origin,
+                                                     const Point2f &initialShift,
+                                                     const Size &maximalShift) const
+{
+    int step = max((int)points.size() / SKELETON_ENGINE_CHAMFER_POINTS, 1);
+    auto costOfShift = [&](const Point2f &shift) {
+        float cost = 0.0f;
+        for (int i = 0; i < (int)points.size(); i += step) {
+            Point position(cvRound(points[i].x + shift.x) - origin.x, cvRound(points[i].y + shift.y) - origin.y);
+            float distance = SKELETON_ENGINE_TRUNCATION_DISTANCE;
+            if (position.x >= 0 && position.y >= 0 && position.x < distances.cols && position.y < distances.rows) {
+                distance = min(distances.at<float>(position), distance);
+            }
+            cost += distance;
+        }
+        return cost;
+    };
+
+    // Search on grid with SKELETON_ENGINE_SEARCH_STEP, then every pixel around the best translation
+    Point2f bestShift = initialShift;
+    float bestCost = costOfShift(initialShift);
+    for (int dy = -maximalShift.height; dy <= maximalShift.height; dy += SKELETON_ENGINE_SEARCH_STEP) {
+        for (int dx = -maximalShift.width; dx <= maximalShift.width; dx += SKELETON_ENGINE_SEARCH_STEP) {
+            Point2f shift(initialShift.x + dx, initialShift.y + dy);
+            float cost = costOfShift(shift);
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestShift = shift;
+            }
+        }
+    }
+    Point2f coarseShift = bestShift;
+    for (int dy = 1 - SKELETON_ENGINE_SEARCH_STEP; dy < SKELETON_ENGINE_SEARCH_STEP; ++dy) {
+        for (int dx = 1 - SKELETON_ENGINE_SEARCH_STEP; dx < SKELETON_ENGINE_SEARCH_STEP; ++dx) {
+            Point2f shift(coarseShift.x + dx, coarseShift.y + dy);
+            float cost = costOfShift(shift);
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestShift = shift;
+            }
+        }
+    }
+    return bestShift;
+}
+
+AGTransformModel AGSkeletonEngine::transformModel() const
+{
+    if (!this->parameters.simplerTransform && this->parameters.rigidTransform) {
+        return this->parameters.rigidTransformModel;
+    }
+    return TranslationModel;
+}
@@ -0,0 +1,74 @@
+//
+//  Created by Aleksander Grzyb on 21/09/15.
+//  Copyright (c) 2015 Aleksander Grzyb. All rights reserved.
+//
+
+#ifndef __Mosaic_Stitcher__AGSkeletonEngine__
+#define __Mosaic_Stitcher__AGSkeletonEngine__
+
+#include "AGRegistrationEngine.h"
+
+#include <stdio.h>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+ /// Registers tiles by aligning skeletons of blood vessels found by AGPathDetection. Skeleton pixels of overlap
+ /// region of the first tile are placed on distance field of the second tile skeleton: translation is found by
+ /// chamfer search around the shift prior and refined with ICP (nearest skeleton pixels are read from labels of the
+ /// distance transform). Confidence is the fraction of skeleton points that lie on the skeleton of the second tile.
+
+class AGSkeletonEngine : public AGRegistrationEngine {
+public:
+
+    /**
+     *  Constructor of AGSkeletonEngine object.
+     *
+     *  @param parameters Loaded parameters from configuration file.
+     */
+    AGSkeletonEngine(const AGParameters &parameters);
+
+    bool registerImages(const AGImage &imageOne,
+                        const AGImage &imageTwo,
+                        ImageDirection imageDirection,
+                        cv::Mat &transform,
+                        double &confidence) const;
+
+    const char *name() const;
+
+private:
+
+    /**
+     *  Returns (at most SKELETON_ENGINE_MAXIMAL_POINTS, evenly taken) skeleton pixels in region of skeleton.
+     *
+     *  @param skeleton Skeleton of image.
+     *  @param region   Region of skeleton.
+     *  @param points   Output points in coordinates of image.
+     */
+    void skeletonPointsInRegion(const cv::Mat &skeleton, const cv::Rect &region, std::vector<cv::Point2f> &points) const;
+
+    /**
+     *  Finds translation with the smallest sum of (truncated) distances of translated points to the skeleton.
+     *
+     *  @param points        Points of first skeleton.
+     *  @param distances     Distance field of second skeleton.
+     *  @param origin        Position of distance field in second image.
+     *  @param initialShift  Center of searched translations.
+     *  @param maximalShift  Maximal distance of searched translations from the center.
+     *
+     *  @return Best translation.
+     */
+    cv::Point2f findShiftWithChamferSearch(const std::vector<cv::Point2f> &points,
+                                           const cv::Mat &distances,
+                                           const cv::Point &origin,
+                                           const cv::Point2f &initialShift,
+                                           const cv::Size &maximalShift) const;
+
+    /**
+     *  Returns model of transform estimated by engine (translation unless rigidTransform is set).
+     *
+     *  @return Model of transform.
+     */
+    AGTransformModel transformModel() const;
+};
+
+#endif /* defined(__Mosaic_Stitcher__AGSkeletonEngine__) */
@@ -0,0 +1,123 @@
+//
+//  Created by Aleksander Grzyb on 21/09/15.
+//  Copyright (c) 2015 Aleksander Grzyb. All rights reserved.
+//
+
+#include "AGThreadPool.h"
+
+#include <algorithm>
+
+using namespace std;
+
+#pragma mark -
+#pragma mark Initialization
+
+AGThreadPool::AGThreadPool(int numberOfThreads)
+{
+    this->numberOfPendingTasks = 0;
+    this->isStopping = false;
+    numberOfThreads = AGThreadPool::resolveNumberOfThreads(numberOfThreads);
+    if (numberOfThreads < 2) {
+        return;
+    }
+    for (int i = 0; i < numberOfThreads; ++i) {
+        this->workers.push_back(thread(&AGThreadPool::performTasks, this));
+    }
+}
+
+AGThreadPool::~AGThreadPool()
+{
+    {
+        unique_lock<std::mutex> lock(this->mutex);
+        this->tasksFinished.wait(lock, [this] { return this->numberOfPendingTasks == 0; });
+        this->isStopping = true;
+    }
+    this->taskAdded.notify_all();
+    for (auto &worker : this->workers) {
+        worker.join();
+    }
+}
+
+int AGThreadPool::resolveNumberOfThreads(int numberOfThreads)
+{
+    if (numberOfThreads <= 0) {
+        numberOfThreads = (int)thread::hardware_concurrency();
+    }
+    return max(numberOfThreads, 1);
+}
+
+int AGThreadPool::numberOfThreads() const
+{
+    return this->workers.empty() ? 1 : (int)this->workers.size();
+}
+
+#pragma mark -
+#pragma mark Tasks
+
+void AGThreadPool::addTask(const function<void()> &task)
+{
+    if (this->workers.empty()) {
+        try {
+            task();
+        }
+        catch (...) {
+            if (!this->taskException) {
+                this->taskException = current_exception();
+            }
+        }
+        return;
+    }
+    {
+        lock_guard<std::mutex> lock(this->mutex);
+        this->tasks.push(task);
+        this->numberOfPendingTasks++;
+    }
+    this->taskAdded.notify_one();
+}
+
+void AGThreadPool::waitForAllTasks()
+{
+    exception_ptr exception;
+    {
+        unique_lock<std::mutex> lock(this->mutex);
+        this->tasksFinished.wait(lock, [this] { return this->numberOfPendingTasks == 0; });
+        exception = this->taskException;
+        this->taskException = nullptr;
+    }
+    if (exception) {
+        rethrow_exception(exception);
+    }
+}
+
+void AGThreadPool::performTasks()
+{
+    while (true) {
+        function<void()> task;
+        {
+            unique_lock<std::mutex> lock(this->mutex);
+            this->taskAdded.wait(lock, [this] { return this->isStopping || !this->tasks.empty(); });
+            if (this->tasks.empty()) {
+                return;
+            }
+            task = this->tasks.front();
+            this->tasks.pop();
+        }
+        exception_ptr exception;
+        try {
+            task();
+        }
+        catch (...) {
+            exception = current_exception();
+        }
+        {
+            lock_guard<std::mutex> lock(this->mutex);
+            if (exception && !this->taskException) {
+                this->taskException = exception;
+            }
+            this->numberOfPendingTasks--;
+            if (this->numberOfPendingTasks == 0) {
+                this->tasksFinished.notify_all();
+            }
+        }
+    }
+}
@@ -0,0 +1,112 @@
+//
+//  Created by Aleksander Grzyb on 21/09/15.
+//  Copyright (c) 2015 Aleksander Grzyb. All rights reserved.
+//
+
+#ifndef __Mosaic_Stitcher__AGThreadPool__
+#define __Mosaic_Stitcher__AGThreadPool__
+
+#include <stdio.h>
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+
+ /// Fixed size pool of worker threads executing independent tasks.
+
+class AGThreadPool {
+public:
+
+    /**
+     *  Constructor of AGThreadPool object. When numberOfThreads is lower than 2, no threads are created and tasks
+     *  are executed immediately in the calling thread.
+     *
+     *  @param numberOfThreads Number of worker threads (0 means number of CPU cores).
+     */
+    AGThreadPool(int numberOfThreads);
+
+    /**
+     *  Waits for all tasks and stops worker threads.
+     */
+    ~AGThreadPool();
+
+    /**
+     *  Adds task to the queue.
+     *
+     *  @param task Task to execute.
+     */
+    void addTask(const std::function<void()> &task);
+
+    /**
+     *  Blocks until all added tasks are finished. Rethrows the first exception thrown by a task.
+     */
+    void waitForAllTasks();
+
+    /**
+     *  Returns number of worker threads (1 when tasks are executed in the calling thread).
+     *
+     *  @return Number of worker threads.
+     */
+    int numberOfThreads() const;
+
+    /**
+     *  Resolves number of threads from configuration value (0 or less means number of CPU cores).
+     *
+     *  @param numberOfThreads Configured number of threads.
+     *
+     *  @return Number of threads to use.
+     */
+    static int resolveNumberOfThreads(int numberOfThreads);
+
+private:
+
+    /**
+     *  Main loop of worker thread.
+     */
+    void performTasks();
+
+    /**
+     *  Worker threads.
+     */
+    std::vector<std::thread> workers;
+
+    /**
+     *  Tasks waiting for execution.
+     */
+    std::queue<std::function<void()>> tasks;
+
+    /**
+     *  Guards tasks queue and counters.
+     */
+    std::mutex mutex;
+
+    /**
+     *  Signalled when task is added or pool is stopping.
+     */
+    std::condition_variable taskAdded;
+
+    /**
+     *  Signalled when all tasks are finished.
+     */
+    std::condition_variable tasksFinished;
+
+    /**
+     *  Number of tasks added and not finished yet.
+     */
+    int numberOfPendingTasks;
+
+    /**
+     *  First exception thrown by a task.
+     */
+    std::exception_ptr taskException;
+
+    /**
+     *  Informs worker threads that they should finish.
+     */
+    bool isStopping;
+};
+
+#endif /* defined(__Mosaic_Stitcher__AGThreadPool__) */
@@ -8,6 +8,9 @@
 #include "AGMosaicStitcher.h"
 #include "AGImageLoader.h"
 #include "AGOpenCVHelper.h"
+#include "AGFeatureCache.h"
+#include "AGBatchPipeline.h"
+#include "AGRunReport.h"
 
 #include <vector>
 #include <iostream>
@@ -15,20 +18,38 @@
 using namespace cv;
 using namespace std;
 
-void createMosaic(vector<vector<AGImage>> &imagesMatrix, const AGParameters &parameters, const string &versionName)
+void createMosaic(const vector<vector<AGImage>> &imagesMatrix,
+                  const AGParameters &parameters,
+                  AGFeatureCache &featureCache,
+                  AGRunReport &runReport,
+                  const string &versionName)
 {
     Mat outputImage;
-    AGMosaicStitcher mosaicStitcher = AGMosaicStitcher(parameters);
+    AGMosaicStitcher mosaicStitcher(parameters, &featureCache, &runReport);
     mosaicStitcher.stitchMosaic(imagesMatrix, outputImage);
     if (outputImage.data) {
         AGError error;
-        AGOpenCVHelper::saveImage(outputImage, versionName, parameters.mosaicsSaveAbsolutePath, error);
+        {
+            AGStageTimer timer(&runReport, "encode");
+            AGOpenCVHelper::saveImage(outputImage, versionName, parameters.mosaicsSaveAbsolutePath, error, parameters.outputFormat);
+        }
         if (error.isError) {
             cout << "createMosaic: " << error.description << endl;
         }
     }
 }
 
+void saveRunReport(AGRunReport &runReport, const AGFeatureCache &featureCache, const AGParameters &parameters)
+{
+    runReport.increaseCounter("featureCache.hits", featureCache.numberOfHits());
+    runReport.increaseCounter("featureCache.misses", featureCache.numberOfMisses());
+    AGError error;
+    runReport.saveToFile(parameters.mosaicsSaveAbsolutePath, error);
+    if (error.isError) {
+        cout << "saveRunReport: " << error.description << endl;
+    }
+}
+
 int main(int argc, const char *argv[])
 {
     bool testMode = false;
@@ -41,55 +62,56 @@ int main(int argc, const char *argv[])
         }
         if (testMode) {
             int testMosaic = 4;
+            AGRunReport runReport("mosaic_" + to_string(testMosaic));
             vector<vector<AGImage>> imagesMatrix;
-            imageLoader.loadTilesInMosaicNumber(imagesMatrix, testMosaic, error);
+            imageLoader.loadTilesInMosaicNumber(imagesMatrix, testMosaic, error, &runReport);
             if (error.isError) {
                 cout << error.description << endl; return EXIT_FAILURE;
             }
             parameters.simplerTransform = false; parameters.rigidTransform = false; parameters.usePaths = true;
-            createMosaic(imagesMatrix, parameters, "mosaic_" + to_string(testMosaic) + "_version_1");
+            AGFeatureCache featureCache;
+            createMosaic(imagesMatrix, parameters, featureCache, runReport, "mosaic_" + to_string(testMosaic) + "_version_1");
+            saveRunReport(runReport, featureCache, parameters);
         }
         else {
+            vector<AGStitchingVersion> versions = {
+                // Version 1
+                { false, true, false },
+                // Version 2
+                { true, true, true },
+                // Version 3
+                { true, true, false },
+                // Version 4
+                { false, false, false }
+            };
+            if (parameters.batchMode) {
+                AGBatchPipeline batchPipeline(imageLoader, parameters, versions);
+                batchPipeline.run(error);
+                batchPipeline.printThroughputReport();
+                if (error.isError) {
+                    cout << error.description << endl; return EXIT_FAILURE;
+                }
+                return EXIT_SUCCESS;
+            }
             for (int i = 1; i <= parameters.numberOfMosaics; ++i) {
+                // Tiles are loaded once and only read by stitcher, so all versions use the same pixel data
+                AGRunReport runReport("mosaic_" + to_string(i));
                 vector<vector<AGImage>> imagesMatrix;
-                imageLoader.loadTilesInMosaicNumber(imagesMatrix, i, error);
+                imageLoader.loadTilesInMosaicNumber(imagesMatrix, i, error, &runReport);
                 if (error.isError) {
                     cout << error.description << endl; return EXIT_FAILURE;
                 }
+                // All versions of the mosaic share features extracted from overlap regions
+                AGFeatureCache featureCache;
                 
-                // Version 1
-                // simplerTransform = false;
-                // rigidTransform = true;
-                // usePaths = false;
-                parameters.simplerTransform = false; parameters.rigidTransform = true; parameters.usePaths = false;
-                createMosaic(imagesMatrix, parameters, "mosaic_" + to_string(i) + "_version_1");
-                imagesMatrix.clear();
-                
-                // Version 2
-                // simplerTransform = true;
-                // rigidTransform = true;
-                // usePaths = true;
-                imageLoader.loadTilesInMosaicNumber(imagesMatrix, i, error);
-                parameters.simplerTransform = true; parameters.rigidTransform = true; parameters.usePaths = true;
-                createMosaic(imagesMatrix, parameters, "mosaic_" + to_string(i) + "_version_2");
-                imagesMatrix.clear();
-                
-                // Version 3
-                // simplerTransform = true;
-                // rigidTransform = true;
-                // usePaths = false;
-                imageLoader.loadTilesInMosaicNumber(imagesMatrix, i, error);
-                parameters.simplerTransform = true; parameters.rigidTransform = true; parameters.usePaths = false;
-                createMosaic(imagesMatrix, parameters, "mosaic_" + to_string(i) + "_version_3");
-                imagesMatrix.clear();
-                
-                // Version 4
-                // simplerTransform = true;
-                // rigidTransform = false;
-                // usePaths = false;
-                imageLoader.loadTilesInMosaicNumber(imagesMatrix, i, error);
-                parameters.simplerTransform = false; parameters.rigidTransform = false; parameters.usePaths = false;
-                createMosaic(imagesMatrix, parameters, "mosaic_" + to_string(i) + "_version_4");
+                for (int version = 0; version < versions.size(); ++version) {
+                    parameters.simplerTransform = versions[version].simplerTransform;
+                    parameters.rigidTransform = versions[version].rigidTransform;
+                    parameters.usePaths = versions[version].usePaths;
+                    createMosaic(imagesMatrix, parameters, featureCache, runReport,
+                                 "mosaic_" + to_string(i) + "_version_" + to_string(version + 1));
+                }
+                saveRunReport(runReport, featureCache, parameters);
             }
         }
     } else {